@@ -69,11 +69,13 @@ http://www.twitch.tv/javidx9
 
 #pragma once
 
+#ifdef _WIN32
 #ifndef UNICODE
 #error Please enable UNICODE for your compiler! VS: Project Properties -> General -> \
 Character Set -> Use Unicode. In Code::Blocks, include 'UNICODE' and '_UNICODE' as \
 pre-processor directives. Thanks! - Javidx9
 #endif
+#endif
 
 #include <iostream>
 #include <chrono>
@@ -82,9 +84,69 @@ pre-processor directives. Thanks! - Javidx9
 #include <thread>
 #include <atomic>
 #include <condition_variable>
+#include <mutex>
+#include <memory>
+#include <functional>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+#include <algorithm>
 using namespace std;
 
+#ifdef _WIN32
 #include <windows.h>
+#else
+// Everything outside of windows gets just enough of the Win32 console types to keep the
+// engine and the games on top of it source compatible. Layout matches the real CHAR_INFO.
+typedef struct _CHAR_INFO {
+	union {
+		char16_t UnicodeChar;
+		char AsciiChar;
+	} Char;
+	unsigned short Attributes;
+} CHAR_INFO;
+
+// Virtual key codes used by games, same values as winuser.h
+#define VK_BACK		0x08
+#define VK_TAB		0x09
+#define VK_RETURN	0x0D
+#define VK_SHIFT	0x10
+#define VK_CONTROL	0x11
+#define VK_ESCAPE	0x1B
+#define VK_SPACE	0x20
+#define VK_PRIOR	0x21
+#define VK_NEXT		0x22
+#define VK_END		0x23
+#define VK_HOME		0x24
+#define VK_LEFT		0x25
+#define VK_UP		0x26
+#define VK_RIGHT	0x27
+#define VK_DOWN		0x28
+#define VK_INSERT	0x2D
+#define VK_DELETE	0x2E
+#define VK_F1		0x70
+#define VK_F2		0x71
+#define VK_F3		0x72
+#define VK_F4		0x73
+
+#define swprintf_s swprintf
+
+inline int _wfopen_s(FILE** f, const wchar_t* name, const wchar_t* mode) {
+	char sName[1024], sMode[16];
+	wcstombs(sName, name, sizeof(sName));
+	wcstombs(sMode, mode, sizeof(sMode));
+	*f = fopen(sName, sMode);
+	return *f == nullptr ? -1 : 0;
+}
+
+#include <unistd.h>
+#include <termios.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#endif
 
 // Colors in Hex
 enum COLOUR {
@@ -185,6 +247,15 @@ public:
 			return m_Glyphs[y * nWidth + x];
 	}
 
+	// Unchecked access to a whole row, for drawing code that has already clipped
+	const wchar_t* GlyphRow(int y) {
+		return m_Glyphs + y * nWidth;
+	}
+
+	const short* ColourRow(int y) {
+		return m_Colours + y * nWidth;
+	}
+
 	wchar_t GetColour(int x, int y) {
 		if (x < 0 || x > nWidth || y < 0 || y > nHeight)
 			return FG_BLACK;
@@ -201,7 +272,14 @@ public:
 		fwrite(&nWidth, sizeof(int), 1, f);
 		fwrite(&nHeight, sizeof(int), 1, f);
 		fwrite(m_Colours, sizeof(short), nWidth * nHeight, f);
-		fwrite(m_Glyphs, sizeof(wchar_t), nWidth * nHeight, f);
+		// Glyphs are 16 bit on disk, whatever size wchar_t is here
+		if (sizeof(wchar_t) == sizeof(char16_t))
+			fwrite(m_Glyphs, sizeof(wchar_t), nWidth * nHeight, f);
+		else
+			for (int i = 0; i < nWidth * nHeight; i++) {
+				char16_t g = (char16_t)m_Glyphs[i];
+				fwrite(&g, sizeof(char16_t), 1, f);
+			}
 
 		fclose(f);
 
@@ -225,34 +303,200 @@ public:
 		Create(nWidth, nHeight);
 
 		fread(m_Colours, sizeof(short), nWidth * nHeight, f);
-		fread(m_Glyphs, sizeof(wchar_t), nWidth * nHeight, f);
+		if (sizeof(wchar_t) == sizeof(char16_t))
+			fread(m_Glyphs, sizeof(wchar_t), nWidth * nHeight, f);
+		else
+			for (int i = 0; i < nWidth * nHeight; i++) {
+				char16_t g = L' ';
+				fread(&g, sizeof(char16_t), 1, f);
+				m_Glyphs[i] = g;
+			}
 
 		fclose(f);
 		return true;
 	}
 };
 
-// Game Engine 
-class ConsoleTemplateEngine {
+// Input Events
+// Backends turn whatever the platform gives them into these and publish them through a
+// lock free single producer, single consumer queue. The game thread drains the queue once
+// a frame, so nothing that happens between frames is lost and there is no per key polling.
+enum INPUT_EVENT {
+	INPUT_KEY = 0,			// nCode = virtual key, bDown = pressed or released
+	INPUT_MOUSE_MOVE,		// x, y = position in screen characters
+	INPUT_MOUSE_BUTTON,		// nCode = button 0..4, bDown = pressed or released
+	INPUT_MOUSE_WHEEL		// nCode = +1 away from the user, -1 towards
+};
+
+struct sInputEvent {
+	unsigned char nType;
+	bool bDown;
+	short nCode;
+	short x;
+	short y;
+};
+
+template<class T, int N>
+class SpscQueue {
 public:
-	// Game Engine Starting Setup
-	ConsoleTemplateEngine() {
-		m_nScreenWidth = 80;
-		m_nScreenHeight = 30;
+	// Producer side only. Returns false and drops the item when full
+	bool Push(const T& item) {
+		int nTail = m_nTail.load(memory_order_relaxed);
+		int nNext = (nTail + 1) % N;
+		if (nNext == m_nHead.load(memory_order_acquire))
+			return false;
+		m_items[nTail] = item;
+		m_nTail.store(nNext, memory_order_release);
+		return true;
+	}
 
-		m_hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-		m_hConsoleIn = GetStdHandle(STD_INPUT_HANDLE);
+	// Consumer side only
+	bool Pop(T& item) {
+		int nHead = m_nHead.load(memory_order_relaxed);
+		if (nHead == m_nTail.load(memory_order_acquire))
+			return false;
+		item = m_items[nHead];
+		m_nHead.store((nHead + 1) % N, memory_order_release);
+		return true;
+	}
 
-		m_keyNewState = new short[256];
-		m_keyOldState = new short[256];
-		memset(m_keyNewState, 0, 256 * sizeof(short));
-		memset(m_keyOldState, 0, 256 * sizeof(short));
-		memset(m_keys, 0, 256 * sizeof(sKeyState));
+private:
+	T m_items[N];
+	// Separate cache lines so producer and consumer don't fight over them
+	alignas(64) atomic<int> m_nHead{ 0 };
+	alignas(64) atomic<int> m_nTail{ 0 };
+};
 
-		m_mousePosX = 0;
-		m_mousePosY = 0;
+typedef SpscQueue<sInputEvent, 1024> InputQueue;
 
-		m_sAppName = L"Default";
+// Platform Backend
+// Everything the engine needs from the outside world goes through here, so the game thread
+// itself never talks to the OS. Input arrives as events in the engine's queue, then once per
+// frame the engine runs the user update and presents the finished screen buffer.
+class ConsoleBackend {
+public:
+	virtual ~ConsoleBackend() {}
+
+	// Set up output for a width x height character screen, returns 1 on success, -1 on failure
+	virtual int Construct(int width, int height, int fontw, int fonth) = 0;
+
+	// Start publishing input events into pQueue, normally from a thread of the backend's own.
+	// The backend must be the queue's only producer
+	virtual void StartInput(InputQueue* pQueue) = 0;
+	virtual void StopInput() {}
+
+	// Called on the game thread just before the input queue is drained each frame
+	virtual void PollInput() {}
+
+	virtual void SetTitle(const wchar_t* title) = 0;
+
+	// Display a completed frame. Returning false asks the engine to stop
+	virtual bool Present(const CHAR_INFO* buf, int width, int height) = 0;
+
+	// Put the console back the way we found it
+	virtual void Restore() {}
+
+	// Backends where presenting costs next to nothing can skip the present thread, which
+	// also keeps frame counting in step with the simulation
+	virtual bool PresentOnGameThread() {
+		return false;
+	}
+};
+
+// Headless Backend
+// No terminal at all, the screen buffer just lives in memory. Input comes from code, either
+// set directly or from a per frame input source callback, so a game can be stepped, profiled
+// and load tested at full speed on a server. Optionally stops the game after nMaxFrames.
+class HeadlessConsoleBackend : public ConsoleBackend {
+public:
+	HeadlessConsoleBackend(int nMaxFrames = 0) {
+		m_nMaxFrames = nMaxFrames;
+		memset(m_keyState, 0, sizeof(m_keyState));
+		memset(m_mouseState, 0, sizeof(m_mouseState));
+		m_nFrameCount = 0;
+		m_pQueue = nullptr;
+	}
+
+	virtual int Construct(int width, int height, int fontw, int fonth) {
+		return 1;
+	}
+
+	virtual void StartInput(InputQueue* pQueue) {
+		m_pQueue = pQueue;
+	}
+
+	virtual void PollInput() {
+		// Programmatic input gets its chance to act just before the frame reads it
+		if (m_inputSource)
+			m_inputSource(m_nFrameCount, *this);
+	}
+
+	virtual void SetTitle(const wchar_t* title) {
+	}
+
+	virtual bool Present(const CHAR_INFO* buf, int width, int height) {
+		m_nFrameCount++;
+		return m_nMaxFrames <= 0 || m_nFrameCount < m_nMaxFrames;
+	}
+
+	virtual bool PresentOnGameThread() {
+		return true;
+	}
+
+public:
+	// Input may be driven from one thread at a time, normally the game thread through the
+	// input source. Only changes of state become events
+	void SetKey(int vk, bool bDown) {
+		if (m_keyState[vk & 0xFF] != bDown)
+			Push({ INPUT_KEY, bDown, (short)(vk & 0xFF), 0, 0 });
+		m_keyState[vk & 0xFF] = bDown;
+	}
+
+	void SetMousePos(int x, int y) {
+		Push({ INPUT_MOUSE_MOVE, false, 0, (short)x, (short)y });
+	}
+
+	void SetMouseButton(int m, bool bDown) {
+		if (m < 0 || m >= 5)
+			return;
+		if (m_mouseState[m] != bDown)
+			Push({ INPUT_MOUSE_BUTTON, bDown, (short)m, 0, 0 });
+		m_mouseState[m] = bDown;
+	}
+
+	void SetInputSource(function<void(int, HeadlessConsoleBackend&)> source) {
+		m_inputSource = source;
+	}
+
+	int FrameCount() {
+		return m_nFrameCount;
+	}
+
+private:
+	void Push(const sInputEvent& e) {
+		if (m_pQueue != nullptr)
+			m_pQueue->Push(e);
+	}
+
+private:
+	bool m_keyState[256];
+	bool m_mouseState[5];
+	atomic<int> m_nFrameCount;
+	int m_nMaxFrames;
+	InputQueue* m_pQueue;
+	function<void(int, HeadlessConsoleBackend&)> m_inputSource;
+};
+
+#ifdef _WIN32
+// Windows Console Backend
+class Win32ConsoleBackend : public ConsoleBackend {
+public:
+	Win32ConsoleBackend() {
+		m_hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+		m_hConsoleIn = GetStdHandle(STD_INPUT_HANDLE);
+		m_hOriginalConsole = m_hConsole;
+		m_nScreenWidth = 80;
+		m_nScreenHeight = 30;
 	}
 
 	// Update 14/09/2017 - Below is the original implementation of CreateConsole(). This works
@@ -304,7 +548,7 @@ public:
 		return 1;
 	}*/
 
-	int ConstructConsole(int width, int height, int fontw, int fonth) {
+	virtual int Construct(int width, int height, int fontw, int fonth) {
 		if (m_hConsole == INVALID_HANDLE_VALUE)
 			return Error(L"Bad Handle");
 
@@ -368,202 +612,1501 @@ public:
 		if (!SetConsoleMode(m_hConsoleIn, ENABLE_EXTENDED_FLAGS | ENABLE_WINDOW_INPUT | ENABLE_MOUSE_INPUT))
 			return Error(L"SetConsoleMode");
 
-		// Allocate memory for screen buffer
-		m_bufScreen = new CHAR_INFO[m_nScreenWidth * m_nScreenHeight];
-		memset(m_bufScreen, 0, sizeof(CHAR_INFO) * m_nScreenWidth * m_nScreenHeight);
-
 		return 1;
 	}
 
-	virtual void Draw(int x, int y, wchar_t c = 0x2588, short col = 0x000F) {
-		// 6/2/2019 Fixed mem overflow issue. Forgot to add y < m_nScreenHeight...
-		if (x >= 0 && x < m_nScreenWidth && y >= 0 && y < m_nScreenHeight) {
-			m_bufScreen[y * m_nScreenWidth + x].Char.UnicodeChar = c;
-			m_bufScreen[y * m_nScreenWidth + x].Attributes = col;
-		}
+
+	virtual void StartInput(InputQueue* pQueue) {
+		m_pQueue = pQueue;
+		m_bInputActive = true;
+		m_threadInput = thread(&Win32ConsoleBackend::InputThread, this);
 	}
 
-	void Fill(int x1, int y1, int x2, int y2, wchar_t c = 0x2588, short col = 0x000F) {
-		Clip(x1, y1);
-		Clip(x2, y2);
-		for (int x = x1; x < x2; x++)
-			for (int y = y1; y < y2; y++)
-				Draw(x, y, c, col);
+	virtual void StopInput() {
+		m_bInputActive = false;
+		if (m_threadInput.joinable())
+			m_threadInput.join();
 	}
 
-	void DrawString(int x, int y, wstring c, short col = 0x000F) {
-		for (size_t i = 0; i < c.size(); i++) {
-			m_bufScreen[y * m_nScreenWidth + x + i].Char.UnicodeChar = c[i];
-			m_bufScreen[y * m_nScreenWidth + x + i].Attributes = col;
-		}
+	virtual void SetTitle(const wchar_t* title) {
+		SetConsoleTitle(title);
 	}
 
-	void DrawStringAlpha(int x, int y, wstring c, short col = 0x000F) {
-		for (size_t i = 0; i < c.size(); i++) {
-			if (c[i] != L' ') {
-				m_bufScreen[y * m_nScreenWidth + x + i].Char.UnicodeChar = c[i];
-				m_bufScreen[y * m_nScreenWidth + x + i].Attributes = col;
-			}
-		}
+	virtual bool Present(const CHAR_INFO* buf, int width, int height) {
+		WriteConsoleOutput(m_hConsole, buf, { (short)width, (short)height }, { 0, 0 }, &m_rectWindow);
+		return true;
 	}
-	// Clip buffer to prevent mem leak
-	void Clip(int& x, int& y) {
-		if (x < 0)
-			x = 0;
-		if (x >= m_nScreenWidth)
-			x = m_nScreenWidth;
-		if (y < 0)
-			y = 0;
-		if (y >= m_nScreenHeight)
-			y = m_nScreenHeight;
+
+	virtual void Restore() {
+		StopInput();
+		SetConsoleActiveScreenBuffer(m_hOriginalConsole);
 	}
 
-	void DrawSprite(int x, int y, TemplateSprite* sprite) {
-		if (sprite == nullptr)
-			return;
+private:
+	// Console input records carry real key up and down events, so they map straight on to
+	// input events. Waits with a timeout so StopInput() is noticed
+	void InputThread() {
+		INPUT_RECORD inBuf[128];
+		DWORD nButtons = 0;
+
+		while (m_bInputActive) {
+			if (WaitForSingleObject(m_hConsoleIn, 50) != WAIT_OBJECT_0)
+				continue;
+
+			DWORD events = 0;
+			if (!ReadConsoleInput(m_hConsoleIn, inBuf, 128, &events))
+				continue;
+
+			for (DWORD i = 0; i < events; i++) {
+				switch (inBuf[i].EventType) {
+				case KEY_EVENT: {
+					const KEY_EVENT_RECORD& k = inBuf[i].Event.KeyEvent;
+					m_pQueue->Push({ INPUT_KEY, k.bKeyDown != 0, (short)(k.wVirtualKeyCode & 0xFF), 0, 0 });
+				}
+				break;
 
-		for (int i = 0; i < sprite->nWidth; i++)
-			for (int j = 0; j < sprite->nHeight; j++)
-				if (sprite->GetGlyphs(i, j) != L' ')
-					Draw(x + i, y + j, sprite->GetGlyphs(i, j), sprite->GetColour(i, j));
+				case MOUSE_EVENT: {
+					const MOUSE_EVENT_RECORD& m = inBuf[i].Event.MouseEvent;
+					switch (m.dwEventFlags) {
+					case MOUSE_MOVED:
+						m_pQueue->Push({ INPUT_MOUSE_MOVE, false, 0, m.dwMousePosition.X, m.dwMousePosition.Y });
+						break;
+					case MOUSE_WHEELED:
+						m_pQueue->Push({ INPUT_MOUSE_WHEEL, false, (short)((short)HIWORD(m.dwButtonState) > 0 ? 1 : -1), 0, 0 });
+						break;
+					case 0:
+					case DOUBLE_CLICK:
+						// Only the whole button state is reported, turn changes into events
+						for (int b = 0; b < 5; b++)
+							if ((m.dwButtonState ^ nButtons) & (1 << b))
+								m_pQueue->Push({ INPUT_MOUSE_BUTTON, (m.dwButtonState & (1 << b)) != 0, (short)b, 0, 0 });
+						nButtons = m.dwButtonState;
+						break;
+					default:
+						break;
+					}
+				}
+				break;
+
+				default:
+					break;
+					//Dont care at the moment
+				}
+			}
+		}
 	}
 
-	void DrawPartialSprite(int x, int y, TemplateSprite* sprite, int ox, int oy, int w, int h) {
-		if (sprite == nullptr)
-			return;
+	int Error(const wchar_t* msg) {
+		wchar_t buf[256];
+		FormatMessage(FORMAT_MESSAGE_FROM_SYSTEM, NULL, GetLastError(), MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), buf, 256, NULL);
+		SetConsoleActiveScreenBuffer(m_hOriginalConsole);
+		return -1;
+	}
 
-		for (int i = 0; i < w; i++)
-			for (int j = 0; j < h; j++)
-				if (sprite->GetGlyphs(i + ox, j + oy) != L' ')
-					Draw(x + i, y + j, sprite->GetGlyphs(i + ox, j + oy), sprite->GetColour(i + ox, j + oy));
+private:
+	int m_nScreenWidth;
+	int m_nScreenHeight;
+	HANDLE m_hOriginalConsole;
+	CONSOLE_SCREEN_BUFFER_INFO m_OriginalConsoleInfo;
+	HANDLE m_hConsole;
+	HANDLE m_hConsoleIn;
+	SMALL_RECT m_rectWindow;
+	InputQueue* m_pQueue = nullptr;
+	atomic<bool> m_bInputActive{ false };
+	thread m_threadInput;
+};
+#else
+// ANSI/VT Terminal Backend
+// Talks to any VT100 style terminal (Linux console, xterm, over SSH...). Bandwidth is the
+// limit here rather than CPU, so each frame is diffed against the last one presented and
+// only the runs of cells that changed are sent, with the shortest cursor movement and only
+// the colour codes that actually differ. Everything for a frame is built in one preallocated
+// buffer and goes out in a single write().
+class AnsiConsoleBackend : public ConsoleBackend {
+public:
+	AnsiConsoleBackend() {
+		m_nScreenWidth = 0;
+		m_nScreenHeight = 0;
+		m_nVisibleWidth = 0;
+		m_nVisibleHeight = 0;
+		m_bufLast = nullptr;
+		m_bufOut = nullptr;
+		m_nOut = 0;
+		m_bConstructed = false;
+		m_bTitleDirty = false;
 	}
 
-	void DrawWireFrameModel(const vector<pair<float, float>>& vecModelCoordinates, float x, float y, float r = 0.0f, float s = 1.0f, short col = FG_WHITE) {
-		// pair.first = x coordinate
-		// pair.second = y coordinate
+	~AnsiConsoleBackend() {
+		Restore();
+		delete[] m_bufLast;
+		delete[] m_bufOut;
+	}
 
-		// Create translated model vector of coordinate pair
-		vector<pair<float, float>> vecTransformedCoordinates;
-		int verts = vecModelCoordinates.size();
-		vecTransformedCoordinates.resize(verts);
+	virtual int Construct(int width, int height, int fontw, int fonth) {
+		m_nScreenWidth = width;
+		m_nScreenHeight = height;
 
-		// Rotate
-		for (int i = 0; i < verts; i++) {
-			vecTransformedCoordinates[i].first = vecModelCoordinates[i].first * cosf(r) - vecModelCoordinates[i].second * sinf(r);
-			vecTransformedCoordinates[i].second = vecModelCoordinates[i].first * sinf(r) + vecModelCoordinates[i].second * cosf(r);
+		// Font size is up to the terminal. If the window is smaller than the game,
+		// present the top left corner that fits rather than scrolling garbage
+		m_nVisibleWidth = width;
+		m_nVisibleHeight = height;
+		winsize ws;
+		if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 && ws.ws_row > 0) {
+			m_nVisibleWidth = min(width, (int)ws.ws_col);
+			m_nVisibleHeight = min(height, (int)ws.ws_row);
 		}
 
-		// Scale
-		for (int i = 0; i < verts; i++) {
-			vecTransformedCoordinates[i].first = vecTransformedCoordinates[i].first * s;
-			vecTransformedCoordinates[i].second = vecTransformedCoordinates[i].second * s;
+		// Last presented frame, starts out matching nothing so the first frame is sent whole
+		m_bufLast = new CHAR_INFO[width * height];
+		for (int i = 0; i < width * height; i++) {
+			m_bufLast[i].Char.UnicodeChar = 0xFFFF;
+			m_bufLast[i].Attributes = 0xFFFF;
 		}
 
-		// Translate
-		for (int i = 0; i < verts; i++) {
-			vecTransformedCoordinates[i].first = vecTransformedCoordinates[i].first + x;
-			vecTransformedCoordinates[i].second = vecTransformedCoordinates[i].second + y;
+		// Worst case per cell is a cursor move, a full colour change and a 3 byte glyph
+		m_nOutSize = width * height * 40 + 4096;
+		m_bufOut = new char[m_nOutSize];
+
+		// Raw mode, keypresses must not echo over the picture and Ctrl+C arrives as a
+		// key so the game can shut down and give the terminal back properly
+		if (isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &m_termOriginal) == 0) {
+			termios t = m_termOriginal;
+			t.c_lflag &= ~(ICANON | ECHO | ISIG);
+			t.c_iflag &= ~(IXON | ICRNL);
+			t.c_cc[VMIN] = 0;
+			t.c_cc[VTIME] = 0;
+			tcsetattr(STDIN_FILENO, TCSANOW, &t);
+			m_bTermSaved = true;
 		}
 
-		// Draw Closed Polygon
-		for (int i = 0; i < verts + 1; i++) {
-			int j = (i + 1);
-			DrawLine((int)vecTransformedCoordinates[i % verts].first, (int)vecTransformedCoordinates[i % verts].second,
-				(int)vecTransformedCoordinates[j % verts].first, (int)vecTransformedCoordinates[j % verts].second, PIXEL_SOLID, col);
-		}
+		// Alternate screen, hide cursor, reset colours, clear, report all mouse
+		// movement in SGR format. Then ask for keys as the kitty keyboard protocol,
+		// with release events, and whether that took. Terminals without it ignore both
+		Append("\x1b[?1049h\x1b[?25l\x1b[0m\x1b[2J\x1b[?1003h\x1b[?1006h");
+		Append("\x1b[>11u\x1b[?u");
+		Flush();
+
+		m_nCursorX = -1;
+		m_nCursorY = -1;
+		m_nAttribute = -1;
+		m_bConstructed = true;
+		return 1;
 	}
 
-	void DrawLine(int x1, int y1, int x2, int y2, wchar_t c = 0x2588, short col = 0x000F) {
-		int x, y, dx, dy, dx1, dy1, px, py, xe, ye, i;
-		dx = x2 - x1;
-		dy = y2 - y1;
-		dx1 = abs(dx);
-		dy1 = abs(dy);
-		px = 2 * dy1 - dx1;
-		py = 2 * dx1 - dy1;
-		if (dy1 <= dx1) {
-			if (dx >= 0) {
-				x = x1;
-				y = y1;
-				xe = x2;
-			}
+	virtual void StartInput(InputQueue* pQueue) {
+		m_pQueue = pQueue;
+		m_bInputActive = true;
+		m_threadInput = thread(&AnsiConsoleBackend::InputThread, this);
+	}
 
-			else {
-				x = x2;
-				y = y2;
-				xe = x1;
-			}
+	virtual void StopInput() {
+		m_bInputActive = false;
+		if (m_threadInput.joinable())
+			m_threadInput.join();
+	}
 
-			Draw(x, y, c, col);
-			for (int i = 0; x < xe; i++) {
-				x = x + 1;
-				if (px < 0)
-					px = px + 2 * dy1;
-				else {
-					if ((dx < 0 && dy < 0) || (dx > 0 && dy > 0))
-						y = y + 1;
-					else
-						y = y - 1;
-					px = px + 2 * (dy1 - dx1);
-				}
+	virtual void SetTitle(const wchar_t* title) {
+		// Only worth the bytes once a second
+		auto tpNow = chrono::steady_clock::now();
+		if (tpNow - m_tpTitle < chrono::seconds(1))
+			return;
+		m_tpTitle = tpNow;
+		m_sTitle = title;
+		m_bTitleDirty = true;
+	}
 
-				Draw(x, y, c, col);
-			}
+	virtual bool Present(const CHAR_INFO* buf, int width, int height) {
+		m_nOut = 0;
+
+		if (m_bTitleDirty) {
+			Append("\x1b]0;");
+			for (wchar_t c : m_sTitle)
+				AppendGlyph(c);
+			Append("\x07");
+			m_bTitleDirty = false;
 		}
 
-		else {
-			if (dy >= 0) {
-				x = x1;
-				y = y1;
-				ye = y2;
-			}
+		for (int y = 0; y < m_nVisibleHeight; y++) {
+			const CHAR_INFO* row = buf + y * width;
+			CHAR_INFO* last = m_bufLast + y * width;
 
-			else {
-				x = x2;
-				y = y2;
-				ye = y1;
-			}
+			int x = 0;
+			while (x < m_nVisibleWidth) {
+				// Skip over cells that are already on screen
+				if (SameCell(row[x], last[x])) {
+					x++;
+					continue;
+				}
 
-			Draw(x, y, c, col);
-			for (i = 0; y < ye; i++) {
-				y = y + 1;
-				if (py <= 0)
-					py = py + 2 * dx1;
-				else {
-					if ((dx < 0 && dy < 0) || (dx > 0 && dy > 0))
-						x = x + 1;
-					else
-						x = x - 1;
-					py = py + 2 * (dx1 - dy1);
+				// Find the end of this changed run. Short gaps of unchanged cells get
+				// merged in, rewriting a couple of cells is cheaper than a cursor move
+				int nEnd = x + 1;
+				int nGap = 0;
+				for (int i = nEnd; i < m_nVisibleWidth && nGap <= 4; i++) {
+					if (SameCell(row[i], last[i]))
+						nGap++;
+					else {
+						nEnd = i + 1;
+						nGap = 0;
+					}
 				}
 
-				Draw(x, y, c, col);
+				MoveCursor(x, y);
+				for (int i = x; i < nEnd; i++) {
+					SetAttribute(row[i].Attributes);
+					AppendGlyph(row[i].Char.UnicodeChar);
+					last[i] = row[i];
+				}
+
+				// Writing the last column leaves the cursor in a pending wrap state
+				// that terminals disagree on, so forget where it is
+				m_nCursorX = nEnd < m_nVisibleWidth ? nEnd : -1;
+				m_nCursorY = y;
+				x = nEnd;
 			}
 		}
-	}
 
-	~ConsoleTemplateEngine() {
-		SetConsoleActiveScreenBuffer(m_hOriginalConsole);
-		delete[] m_bufScreen;
+		Flush();
+		return !m_bQuit;
 	}
 
-public:
-	void Start() {
-		m_bAtomActive = true;
+	virtual void Restore() {
+		StopInput();
+		if (!m_bConstructed)
+			return;
+		m_nOut = 0;
+		Append("\x1b[<u\x1b[?1006l\x1b[?1003l\x1b[0m\x1b[?25h\x1b[?1049l");
+		Flush();
+		if (m_bTermSaved)
+			tcsetattr(STDIN_FILENO, TCSANOW, &m_termOriginal);
+		m_bConstructed = false;
+	}
 
-		// Start the thread
-		thread t = thread(&ConsoleTemplateEngine::GameThread, this);
+	// Without the kitty keyboard protocol a terminal sends no key releases. A key then
+	// counts as released once it stops auto repeating, or when another key is pressed,
+	// as only the last key pressed repeats. Until a key first repeats there is no telling
+	// it from a tap, so the wait for that must outlast the terminal's repeat delay (660ms
+	// on X11 by default) or a held key is released early. It is learnt from the first
+	// key that repeats, this is where it starts
+	void SetKeyReleaseDelay(int nMilliseconds) {
+		m_nReleaseDelay = nMilliseconds;
+	}
 
-		// Wait for thread to exit
-		unique_lock<mutex> m_muxLock(m_muxGame);
-		m_cvGameFinished.wait(m_muxLock);
+private:
+	// Terminals send bytes, not keys: characters, escape sequences for special keys and
+	// SGR mouse reports. Only those speaking the kitty keyboard protocol say when a key
+	// goes up, otherwise see SetKeyReleaseDelay()
+	void InputThread() {
+		char buf[256];
+		string sPending;
+		auto tpPending = chrono::steady_clock::now();
+		pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+
+		while (m_bInputActive) {
+			if (poll(&pfd, 1, 20) > 0 && (pfd.revents & POLLIN)) {
+				int n = (int)read(STDIN_FILENO, buf, sizeof(buf));
+				if (n > 0) {
+					sPending.append(buf, n);
+					size_t nUsed = ParseInput(sPending.data(), sPending.size());
+					sPending.erase(0, nUsed);
+					if (sPending.size() > 64)
+						sPending.clear(); // Garbage, don't let it build up
+					tpPending = chrono::steady_clock::now();
+				}
+			}
 
-		// Tidy up
-		t.join();
-	}
+			// A sequence can arrive split across reads, over ssh especially, so an escape
+			// left over is only the escape key once nothing has followed it for a while
+			if (!sPending.empty() && chrono::steady_clock::now() - tpPending > chrono::milliseconds(100)) {
+				if (sPending[0] == 0x1B) {
+					KeyPressed(VK_ESCAPE);
+					sPending.erase(0, 1);
+					sPending.erase(0, ParseInput(sPending.data(), sPending.size()));
+				}
+				else
+					sPending.clear();
+				tpPending = chrono::steady_clock::now();
+			}
 
-	int ScreenWidth() {
-		return m_nScreenWidth;
+			// Release keys that have stopped repeating. Before auto repeat kicks in
+			// the gap is long, after that it is short
+			if (m_bKeyReleases)
+				continue;
+			auto tpNow = chrono::steady_clock::now();
+			for (int k = 0; k < 256; k++)
+				if (m_bKeyHeld[k] && tpNow - m_tpKeyLast[k] > chrono::milliseconds(m_bKeyRepeating[k] ? 100 : m_nReleaseDelay.load()))
+					KeyReleased(k);
+		}
+	}
+
+	void KeyPressed(int vk) {
+		auto tpNow = chrono::steady_clock::now();
+		if (m_bKeyHeld[vk]) {
+			// The first repeat shows how long this terminal waits before repeating
+			if (!m_bKeyRepeating[vk] && !m_bKeyReleases) {
+				int nDelay = (int)chrono::duration_cast<chrono::milliseconds>(tpNow - m_tpKeyLast[vk]).count();
+				m_nReleaseDelay = max(150, min(nDelay + 60, 1000));
+			}
+			m_bKeyRepeating[vk] = true;
+		}
+		else {
+			// Only the last key pressed repeats, so any other is no longer held
+			if (!m_bKeyReleases)
+				for (int k = 0; k < 256; k++)
+					if (m_bKeyHeld[k])
+						KeyReleased(k);
+			m_bKeyHeld[vk] = true;
+			m_bKeyRepeating[vk] = false;
+			m_pQueue->Push({ INPUT_KEY, true, (short)vk, 0, 0 });
+		}
+		m_tpKeyLast[vk] = tpNow;
+	}
+
+	void KeyReleased(int vk) {
+		if (!m_bKeyHeld[vk])
+			return;
+		m_bKeyHeld[vk] = false;
+		m_pQueue->Push({ INPUT_KEY, false, (short)vk, 0, 0 });
+	}
+
+	// Virtual key for a character the terminal sent, 0 for one the engine has no key for
+	int KeyFromChar(int c) {
+		if (c >= 'a' && c <= 'z')
+			return c - 'a' + 'A';
+		if ((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))
+			return c;
+		switch (c) {
+		case ' ': return VK_SPACE;
+		case '\t': return VK_TAB;
+		case '\r': case '\n': return VK_RETURN;
+		case 0x7F: case 0x08: return VK_BACK;
+		case 0x1B: return VK_ESCAPE;
+		}
+		return 0;
+	}
+
+	// Kitty keyboard protocol events are 1 press, 2 repeat and 3 release
+	void KeyEvent(int vk, int nEvent) {
+		if (vk == 0)
+			return;
+		if (nEvent == 3)
+			KeyReleased(vk);
+		else
+			KeyPressed(vk);
+	}
+
+	// Returns how many bytes were used, anything left is an unfinished sequence
+	size_t ParseInput(const char* s, size_t n) {
+		size_t i = 0;
+		while (i < n) {
+			unsigned char c = s[i];
+
+			if (c == 0x1B) {
+				// Escape on its own may be the start of a sequence still on its way, leave it
+				// for InputThread() to decide
+				if (i + 1 >= n)
+					return i;
+				else if (s[i + 1] == '[') {
+					// Control sequence, parameters up to a final byte in 0x40..0x7E
+					size_t j = i + 2;
+					while (j < n && !(s[j] >= 0x40 && s[j] <= 0x7E))
+						j++;
+					if (j >= n)
+						return i;
+					ParseCSI(s + i + 2, j - i - 2, s[j]);
+					i = j + 1;
+				}
+				else if (s[i + 1] == 'O') {
+					if (i + 2 >= n)
+						return i;
+					ParseCSI(s + i + 2, 0, s[i + 2]);
+					i += 3;
+				}
+				else
+					i++; // Alt + key, just take the key
+				continue;
+			}
+
+			if (c == 0x03)
+				m_bQuit = true;
+			else if (int vk = KeyFromChar(c))
+				KeyPressed(vk);
+			i++;
+		}
+		return i;
+	}
+
+	void ParseCSI(const char* s, size_t n, char cFinal) {
+		// Numeric parameters separated by ;, the kitty keyboard protocol follows the
+		// modifiers with :event
+		int p[4] = { 0, 0, 0, 0 };
+		int nEvent = 1;
+		int np = 0;
+		bool bSub = false;
+		bool bSGRMouse = n > 0 && s[0] == '<';
+		bool bReply = n > 0 && s[0] == '?';
+		for (size_t i = (bSGRMouse || bReply) ? 1 : 0; i < n && np < 4; i++) {
+			if (s[i] >= '0' && s[i] <= '9') {
+				if (!bSub)
+					p[np] = p[np] * 10 + (s[i] - '0');
+				else if (np == 1)
+					nEvent = s[i] - '0';
+			}
+			else if (s[i] == ';') {
+				np++;
+				bSub = false;
+			}
+			else if (s[i] == ':') {
+				// Only the modifiers' event matters, alternate key codes are skipped
+				bSub = true;
+			}
+		}
+
+		// Answer to asking which keyboard protocol flags are on, real key releases from now
+		if (bReply) {
+			if (cFinal == 'u')
+				m_bKeyReleases = true;
+			return;
+		}
+
+		if (bSGRMouse && (cFinal == 'M' || cFinal == 'm')) {
+			int b = p[0];
+			m_pQueue->Push({ INPUT_MOUSE_MOVE, false, 0, (short)(p[1] - 1), (short)(p[2] - 1) });
+			if (b & 64)
+				m_pQueue->Push({ INPUT_MOUSE_WHEEL, false, (short)((b & 1) ? -1 : 1), 0, 0 });
+			else if (!(b & 32) && (b & 3) != 3) {
+				// Terminal numbers buttons left, middle, right, console left, right, middle
+				const short nButton[3] = { 0, 2, 1 };
+				m_pQueue->Push({ INPUT_MOUSE_BUTTON, cFinal == 'M', nButton[b & 3], 0, 0 });
+			}
+			return;
+		}
+
+		switch (cFinal) {
+		case 'A': KeyEvent(VK_UP, nEvent); break;
+		case 'B': KeyEvent(VK_DOWN, nEvent); break;
+		case 'C': KeyEvent(VK_RIGHT, nEvent); break;
+		case 'D': KeyEvent(VK_LEFT, nEvent); break;
+		case 'H': KeyEvent(VK_HOME, nEvent); break;
+		case 'F': KeyEvent(VK_END, nEvent); break;
+		case 'P': KeyEvent(VK_F1, nEvent); break;
+		case 'Q': KeyEvent(VK_F2, nEvent); break;
+		case 'R': KeyEvent(VK_F3, nEvent); break;
+		case 'S': KeyEvent(VK_F4, nEvent); break;
+		case 'Z': KeyEvent(VK_TAB, nEvent); break; // Shift + Tab
+		case 'u':
+			// Kitty keyboard protocol, a key's code then 1 + a modifier bitmask, Ctrl is 4
+			if (p[0] == 'c' && p[1] > 0 && ((p[1] - 1) & 4))
+				m_bQuit = true;
+			else if (p[0] < 128)
+				KeyEvent(KeyFromChar(p[0]), nEvent);
+			break;
+		case '~':
+			switch (p[0]) {
+			case 1: case 7: KeyEvent(VK_HOME, nEvent); break;
+			case 2: KeyEvent(VK_INSERT, nEvent); break;
+			case 3: KeyEvent(VK_DELETE, nEvent); break;
+			case 4: case 8: KeyEvent(VK_END, nEvent); break;
+			case 5: KeyEvent(VK_PRIOR, nEvent); break;
+			case 6: KeyEvent(VK_NEXT, nEvent); break;
+			case 11: KeyEvent(VK_F1, nEvent); break;
+			case 12: KeyEvent(VK_F2, nEvent); break;
+			case 13: KeyEvent(VK_F3, nEvent); break;
+			case 14: KeyEvent(VK_F4, nEvent); break;
+			}
+			break;
+		}
+	}
+
+	static bool SameCell(const CHAR_INFO& a, const CHAR_INFO& b) {
+		return a.Char.UnicodeChar == b.Char.UnicodeChar && a.Attributes == b.Attributes;
+	}
+
+	void Append(const char* s) {
+		while (*s)
+			m_bufOut[m_nOut++] = *s++;
+	}
+
+	void AppendNumber(int n) {
+		char s[12];
+		int i = 0;
+		do {
+			s[i++] = '0' + n % 10;
+			n /= 10;
+		} while (n > 0);
+		while (i > 0)
+			m_bufOut[m_nOut++] = s[--i];
+	}
+
+	// UTF-8 encode, console glyphs are all in the basic multilingual plane
+	void AppendGlyph(wchar_t c) {
+		if (c == 0)
+			c = L' ';
+		if (c < 0x80)
+			m_bufOut[m_nOut++] = (char)c;
+		else if (c < 0x800) {
+			m_bufOut[m_nOut++] = (char)(0xC0 | (c >> 6));
+			m_bufOut[m_nOut++] = (char)(0x80 | (c & 0x3F));
+		}
+		else {
+			m_bufOut[m_nOut++] = (char)(0xE0 | ((c >> 12) & 0x0F));
+			m_bufOut[m_nOut++] = (char)(0x80 | ((c >> 6) & 0x3F));
+			m_bufOut[m_nOut++] = (char)(0x80 | (c & 0x3F));
+		}
+	}
+
+	void MoveCursor(int x, int y) {
+		if (m_nCursorY == y && m_nCursorX == x)
+			return;
+
+		if (m_nCursorY == y && m_nCursorX >= 0 && x > m_nCursorX) {
+			// Cursor forward on the same row
+			Append("\x1b[");
+			if (x - m_nCursorX > 1)
+				AppendNumber(x - m_nCursorX);
+			Append("C");
+		}
+		else if (x == 0 && m_nCursorY >= 0 && y == m_nCursorY + 1) {
+			Append("\r\n");
+		}
+		else if (x == 0) {
+			Append("\x1b[");
+			AppendNumber(y + 1);
+			Append("H");
+		}
+		else {
+			Append("\x1b[");
+			AppendNumber(y + 1);
+			Append(";");
+			AppendNumber(x + 1);
+			Append("H");
+		}
+
+		m_nCursorX = x;
+		m_nCursorY = y;
+	}
+
+	void SetAttribute(unsigned short col) {
+		if (m_nAttribute == col)
+			return;
+
+		// Console colours are BGR-I, ANSI colours are RGB, so swap red and blue bits
+		auto ToAnsi = [](int c) { return (c & 0x2) | ((c & 0x1) << 2) | ((c & 0x4) >> 2); };
+
+		int fg = col & 0x0F;
+		int bg = (col >> 4) & 0x0F;
+		bool bFgChanged = m_nAttribute < 0 || (m_nAttribute & 0x0F) != fg;
+		bool bBgChanged = m_nAttribute < 0 || ((m_nAttribute >> 4) & 0x0F) != bg;
+
+		Append("\x1b[");
+		if (bFgChanged) {
+			AppendNumber(((fg & 0x8) ? 90 : 30) + ToAnsi(fg));
+			if (bBgChanged)
+				Append(";");
+		}
+		if (bBgChanged)
+			AppendNumber(((bg & 0x8) ? 100 : 40) + ToAnsi(bg));
+		Append("m");
+
+		m_nAttribute = col;
+	}
+
+	void Flush() {
+		size_t nDone = 0;
+		while (nDone < m_nOut) {
+			ssize_t n = write(STDOUT_FILENO, m_bufOut + nDone, m_nOut - nDone);
+			if (n <= 0)
+				break;
+			nDone += n;
+		}
+		m_nOut = 0;
+	}
+
+private:
+	int m_nScreenWidth;
+	int m_nScreenHeight;
+	int m_nVisibleWidth;
+	int m_nVisibleHeight;
+	CHAR_INFO* m_bufLast;
+	char* m_bufOut;
+	size_t m_nOut;
+	size_t m_nOutSize;
+	int m_nCursorX;
+	int m_nCursorY;
+	int m_nAttribute;
+	bool m_bConstructed;
+	bool m_bTermSaved = false;
+	termios m_termOriginal;
+	wstring m_sTitle;
+	bool m_bTitleDirty;
+	chrono::steady_clock::time_point m_tpTitle;
+
+	InputQueue* m_pQueue = nullptr;
+	atomic<bool> m_bInputActive{ false };
+	atomic<bool> m_bQuit{ false };
+	thread m_threadInput;
+	bool m_bKeyHeld[256] = {};
+	bool m_bKeyRepeating[256] = {};
+	chrono::steady_clock::time_point m_tpKeyLast[256];
+	bool m_bKeyReleases = false;		// Terminal speaks the kitty keyboard protocol
+	atomic<int> m_nReleaseDelay{ 700 };
+};
+#endif
+
+// Frame Profiler
+// Named phases are timed with ProfileScope, which can be entered any number of times a
+// frame (e.g. once per physics substep) and accumulates. At the end of each frame the totals
+// go into a ring buffer per phase so p50/p99 over the last HISTORY frames can be reported.
+// Counters work the same way for things that are counted rather than timed. Only the game
+// thread may touch the profiler.
+class FrameProfiler {
+public:
+	static const int MAX_PHASES = 16;
+	static const int MAX_COUNTERS = 16;
+	static const int HISTORY = 128;
+
+	// Register a phase or counter once up front, then refer to it by the returned id
+	int AddPhase(const wchar_t* sName) {
+		if (m_nPhases >= MAX_PHASES)
+			return -1;
+		m_phases[m_nPhases].sName = sName;
+		return m_nPhases++;
+	}
+
+	int AddCounter(const wchar_t* sName) {
+		if (m_nCounters >= MAX_COUNTERS)
+			return -1;
+		m_counters[m_nCounters].sName = sName;
+		return m_nCounters++;
+	}
+
+	void AddTime(int nPhase, float fMilliseconds) {
+		if (nPhase < 0)
+			return;
+		m_phases[nPhase].fFrameTotal += fMilliseconds;
+		m_phases[nPhase].nFrameCalls++;
+	}
+
+	// For sections that don't fit neatly in a scope
+	void AddTimeSince(int nPhase, chrono::steady_clock::time_point tpStart) {
+		AddTime(nPhase, chrono::duration<float, milli>(chrono::steady_clock::now() - tpStart).count());
+	}
+
+	// Time added to a phase so far this frame, so an enclosing phase can leave it out
+	float FrameTime(int nPhase) const {
+		return nPhase < 0 ? 0.0f : m_phases[nPhase].fFrameTotal;
+	}
+
+	void Count(int nCounter, int nAmount = 1) {
+		if (nCounter >= 0)
+			m_counters[nCounter].nFrameTotal += nAmount;
+	}
+
+	void SetCount(int nCounter, int nValue) {
+		if (nCounter >= 0)
+			m_counters[nCounter].nFrameTotal = nValue;
+	}
+
+	void EndFrame() {
+		for (int i = 0; i < m_nPhases; i++) {
+			m_phases[i].fHistory[m_nHead] = m_phases[i].fFrameTotal;
+			m_phases[i].nLastCalls = m_phases[i].nFrameCalls;
+			m_phases[i].fFrameTotal = 0.0f;
+			m_phases[i].nFrameCalls = 0;
+		}
+		for (int i = 0; i < m_nCounters; i++) {
+			m_counters[i].nHistory[m_nHead] = m_counters[i].nFrameTotal;
+			m_counters[i].nFrameTotal = 0;
+		}
+		m_nHead = (m_nHead + 1) % HISTORY;
+		if (m_nFrames < HISTORY)
+			m_nFrames++;
+	}
+
+	// Draw a table of all phases and counters, top left at x, y
+	template<class ENGINE>
+	void DrawOverlay(ENGINE* engine, int x, int y, short col = FG_WHITE | BG_DARK_GREY) {
+		wchar_t s[64];
+		swprintf_s(s, 64, L"%-10ls %7ls %7ls %7ls %4ls", L"phase ms", L"last", L"p50", L"p99", L"n");
+		engine->DrawString(x, y++, s, col);
+		for (int i = 0; i < m_nPhases; i++) {
+			float fSorted[HISTORY];
+			int nLast = (m_nHead + HISTORY - 1) % HISTORY;
+			copy(m_phases[i].fHistory, m_phases[i].fHistory + m_nFrames, fSorted);
+			sort(fSorted, fSorted + m_nFrames);
+			swprintf_s(s, 64, L"%-10ls %7.3f %7.3f %7.3f %4d", m_phases[i].sName, m_phases[i].fHistory[nLast],
+				Percentile(fSorted, 0.5f), Percentile(fSorted, 0.99f), m_phases[i].nLastCalls);
+			engine->DrawString(x, y++, s, col);
+		}
+		for (int i = 0; i < m_nCounters; i++) {
+			float fSorted[HISTORY];
+			int nLast = (m_nHead + HISTORY - 1) % HISTORY;
+			for (int j = 0; j < m_nFrames; j++)
+				fSorted[j] = (float)m_counters[i].nHistory[j];
+			sort(fSorted, fSorted + m_nFrames);
+			swprintf_s(s, 64, L"%-10ls %7d %7.0f %7.0f     ", m_counters[i].sName, m_counters[i].nHistory[nLast],
+				Percentile(fSorted, 0.5f), Percentile(fSorted, 0.99f));
+			engine->DrawString(x, y++, s, col);
+		}
+	}
+
+	// Characters wide and high DrawOverlay() needs
+	int OverlayWidth() {
+		return 41;
+	}
+
+	int OverlayHeight() {
+		return 1 + m_nPhases + m_nCounters;
+	}
+
+private:
+	float Percentile(const float* fSorted, float p) {
+		if (m_nFrames == 0)
+			return 0.0f;
+		return fSorted[min(m_nFrames - 1, (int)(p * m_nFrames))];
+	}
+
+	struct sPhase {
+		const wchar_t* sName = L"";
+		float fFrameTotal = 0.0f;
+		int nFrameCalls = 0;
+		int nLastCalls = 0;
+		float fHistory[HISTORY] = {};
+	} m_phases[MAX_PHASES];
+
+	struct sCounter {
+		const wchar_t* sName = L"";
+		int nFrameTotal = 0;
+		int nHistory[HISTORY] = {};
+	} m_counters[MAX_COUNTERS];
+
+	int m_nPhases = 0;
+	int m_nCounters = 0;
+	int m_nHead = 0;
+	int m_nFrames = 0;
+};
+
+// Times its own lifetime into a profiler phase
+class ProfileScope {
+public:
+	ProfileScope(FrameProfiler& profiler, int nPhase) : m_profiler(profiler) {
+		m_nPhase = nPhase;
+		m_tpStart = chrono::steady_clock::now();
+	}
+
+	~ProfileScope() {
+		chrono::duration<float, milli> fTime = chrono::steady_clock::now() - m_tpStart;
+		m_profiler.AddTime(m_nPhase, fTime.count());
+	}
+
+private:
+	FrameProfiler& m_profiler;
+	int m_nPhase;
+	chrono::steady_clock::time_point m_tpStart;
+};
+
+// Worker Pool
+// A fixed set of threads for fork/join style parallel loops. ParallelFor() hands out task
+// indices from a shared counter, so faster threads simply take more of them, and the
+// calling thread works through tasks too rather than sitting idle. With no worker threads
+// it degrades to a plain loop.
+class WorkerPool {
+public:
+	~WorkerPool() {
+		Stop();
+	}
+
+	void Start(int nThreads) {
+		Stop();
+		m_bRunning = true;
+		for (int i = 0; i < nThreads; i++)
+			m_vecThreads.emplace_back(&WorkerPool::WorkerThread, this);
+	}
+
+	void Stop() {
+		{
+			lock_guard<mutex> lock(m_mux);
+			m_bRunning = false;
+		}
+		m_cvWork.notify_all();
+		for (auto& t : m_vecThreads)
+			t.join();
+		m_vecThreads.clear();
+	}
+
+	// Threads that can work on a ParallelFor(), including the caller
+	int Concurrency() {
+		return (int)m_vecThreads.size() + 1;
+	}
+
+	// Runs fn(0) .. fn(nTasks - 1) across the pool and returns once all have finished
+	void ParallelFor(int nTasks, const function<void(int)>& fn) {
+		if (m_vecThreads.empty() || nTasks <= 1) {
+			for (int i = 0; i < nTasks; i++)
+				fn(i);
+			return;
+		}
+
+		{
+			// A worker that woke late for the last job may still be looking at it, the
+			// counter can't be reset under it
+			unique_lock<mutex> lock(m_mux);
+			m_cvIdle.wait(lock, [&] { return m_nActive == 0; });
+			m_pJob = &fn;
+			m_nTasks = nTasks;
+			m_nNext = 0;
+			m_nGeneration++;
+		}
+		m_cvWork.notify_all();
+
+		RunTasks(&fn, nTasks);
+
+		// Every task has been handed out, so once no worker is active they have all
+		// finished and fn, which may live on the caller's stack, is no longer used
+		while (m_nActive > 0)
+			this_thread::yield();
+	}
+
+private:
+	void RunTasks(const function<void(int)>* pJob, int nTasks) {
+		int i;
+		while ((i = m_nNext++) < nTasks)
+			(*pJob)(i);
+	}
+
+	void WorkerThread() {
+		int nSeen = 0;
+		while (true) {
+			const function<void(int)>* pJob;
+			int nTasks;
+			{
+				// Take the job while it can't change, and stay counted as active until
+				// done with it
+				unique_lock<mutex> lock(m_mux);
+				m_cvWork.wait(lock, [&] { return m_nGeneration != nSeen || !m_bRunning; });
+				if (!m_bRunning)
+					return;
+				nSeen = m_nGeneration;
+				pJob = m_pJob;
+				nTasks = m_nTasks;
+				m_nActive++;
+			}
+			RunTasks(pJob, nTasks);
+			{
+				lock_guard<mutex> lock(m_mux);
+				m_nActive--;
+			}
+			m_cvIdle.notify_one();
+		}
+	}
+
+private:
+	vector<thread> m_vecThreads;
+	mutex m_mux;
+	condition_variable m_cvWork;
+	condition_variable m_cvIdle;
+	bool m_bRunning = false;
+	int m_nGeneration = 0;
+	const function<void(int)>* m_pJob = nullptr;	// Guarded by m_mux, workers take a copy
+	int m_nTasks = 0;
+	atomic<int> m_nNext{ 0 };
+	atomic<int> m_nActive{ 0 };					// Workers holding a job, changed under m_mux
+};
+
+// Band Bins
+// Sorts the things to draw into the screen bands they reach, once per frame, so each band of a
+// ParallelBands() pass only looks at its own rather than at everything on the map. Something
+// reaching into several bands goes in each of them, in every bin items keep their order
+class BandBins {
+public:
+	// Bins items 0 up to n. fnBands(i, b1, b2) sets the bands b1 to b2 that item i reaches
+	// and returns false to leave it out altogether
+	template<class F>
+	void Build(int nBands, int n, F fnBands) {
+		m_vecStart.assign(nBands + 1, 0);
+		m_vecRange.resize(n * 2);
+		for (int i = 0; i < n; i++) {
+			int b1 = 0, b2 = -1;
+			if (fnBands(i, b1, b2)) {
+				b1 = max(0, b1);
+				b2 = min(nBands - 1, b2);
+			}
+			else
+				b2 = b1 - 1;
+			m_vecRange[i * 2] = b1;
+			m_vecRange[i * 2 + 1] = b2;
+			for (int b = b1; b <= b2; b++)
+				m_vecStart[b + 1]++;
+		}
+
+		for (int b = 0; b < nBands; b++)
+			m_vecStart[b + 1] += m_vecStart[b];
+		m_vecItems.resize(m_vecStart[nBands]);
+		m_vecFill.assign(m_vecStart.begin(), m_vecStart.end() - 1);
+		for (int i = 0; i < n; i++)
+			for (int b = m_vecRange[i * 2]; b <= m_vecRange[i * 2 + 1]; b++)
+				m_vecItems[m_vecFill[b]++] = i;
+	}
+
+	// Calls fn(i) for each item binned in band b
+	template<class F>
+	void ForEach(int b, F fn) const {
+		for (int k = m_vecStart[b]; k < m_vecStart[b + 1]; k++)
+			fn(m_vecItems[k]);
+	}
+
+private:
+	vector<int> m_vecStart;
+	vector<int> m_vecFill;
+	vector<int> m_vecRange;
+	vector<int> m_vecItems;
+};
+
+// Slot Map
+// Owns objects of one type in a dense array and hands out handles rather than pointers.
+// A handle names a slot plus the generation it was issued for, so once its object has been
+// removed Get() returns nullptr instead of whatever reused the memory. Removal swaps the last
+// object into the hole, keeping iteration a straight walk over contiguous storage. Pointers
+// from Get() or iteration are only good until the next Emplace() or Remove().
+struct SlotHandle {
+	uint32_t nIndex = 0xFFFFFFFF;
+	uint32_t nGeneration = 0;
+
+	bool operator==(const SlotHandle& h) const { return nIndex == h.nIndex && nGeneration == h.nGeneration; }
+	bool operator!=(const SlotHandle& h) const { return !(*this == h); }
+};
+
+template<class T>
+class SlotMap {
+public:
+	template<class... Args>
+	SlotHandle Emplace(Args&&... args) {
+		uint32_t nSlot;
+		if (m_vecFree.empty()) {
+			nSlot = (uint32_t)m_vecSlots.size();
+			m_vecSlots.push_back({ 0, 0 });
+		}
+		else {
+			nSlot = m_vecFree.back();
+			m_vecFree.pop_back();
+		}
+
+		m_vecSlots[nSlot].nDense = (uint32_t)m_vecObjects.size();
+		m_vecObjects.emplace_back(forward<Args>(args)...);
+		m_vecDenseToSlot.push_back(nSlot);
+		return { nSlot, m_vecSlots[nSlot].nGeneration };
+	}
+
+	// Null if the handle's object has gone, or never existed
+	T* Get(SlotHandle h) {
+		if (h.nIndex >= m_vecSlots.size() || m_vecSlots[h.nIndex].nGeneration != h.nGeneration)
+			return nullptr;
+		return &m_vecObjects[m_vecSlots[h.nIndex].nDense];
+	}
+
+	bool Remove(SlotHandle h) {
+		if (Get(h) == nullptr)
+			return false;
+		RemoveDense(m_vecSlots[h.nIndex].nDense);
+		return true;
+	}
+
+	// Removes every object the predicate picks, returns how many went
+	template<class F>
+	int RemoveIf(F pred) {
+		int nRemoved = 0;
+		for (size_t i = 0; i < m_vecObjects.size();) {
+			if (pred(m_vecObjects[i])) {
+				RemoveDense((uint32_t)i);
+				nRemoved++;
+			}
+			else
+				i++;
+		}
+		return nRemoved;
+	}
+
+	void Clear() {
+		while (!m_vecObjects.empty())
+			RemoveDense((uint32_t)m_vecObjects.size() - 1);
+	}
+
+	// Handle for the object at position i of the iteration order
+	SlotHandle HandleAt(size_t i) const {
+		uint32_t nSlot = m_vecDenseToSlot[i];
+		return { nSlot, m_vecSlots[nSlot].nGeneration };
+	}
+
+	size_t Size() const { return m_vecObjects.size(); }
+	T& operator[](size_t i) { return m_vecObjects[i]; }
+	typename vector<T>::iterator begin() { return m_vecObjects.begin(); }
+	typename vector<T>::iterator end() { return m_vecObjects.end(); }
+
+private:
+	void RemoveDense(uint32_t nDense) {
+		uint32_t nSlot = m_vecDenseToSlot[nDense];
+		uint32_t nLast = (uint32_t)m_vecObjects.size() - 1;
+		if (nDense != nLast) {
+			m_vecObjects[nDense] = move(m_vecObjects[nLast]);
+			m_vecDenseToSlot[nDense] = m_vecDenseToSlot[nLast];
+			m_vecSlots[m_vecDenseToSlot[nDense]].nDense = nDense;
+		}
+		m_vecObjects.pop_back();
+		m_vecDenseToSlot.pop_back();
+
+		// Stale every outstanding handle to this slot before it can be reused
+		m_vecSlots[nSlot].nGeneration++;
+		m_vecFree.push_back(nSlot);
+	}
+
+	struct sSlot {
+		uint32_t nDense;
+		uint32_t nGeneration;
+	};
+
+	vector<T> m_vecObjects;
+	vector<uint32_t> m_vecDenseToSlot;
+	vector<sSlot> m_vecSlots;
+	vector<uint32_t> m_vecFree;
+};
+
+// Game Engine 
+class ConsoleTemplateEngine {
+public:
+	// Game Engine Starting Setup
+	ConsoleTemplateEngine() {
+		m_nScreenWidth = 80;
+		m_nScreenHeight = 30;
+		m_bufScreen = nullptr;
+
+#ifdef _WIN32
+		m_pBackend.reset(new Win32ConsoleBackend());
+#else
+		if (isatty(STDOUT_FILENO))
+			m_pBackend.reset(new AnsiConsoleBackend());
+		else
+			m_pBackend.reset(new HeadlessConsoleBackend());
+#endif
+		m_fFixedElapsedTime = 0.0f;
+
+		memset(m_keys, 0, 256 * sizeof(sKeyState));
+		memset(m_mouse, 0, 5 * sizeof(sKeyState));
+
+		m_mousePosX = 0;
+		m_mousePosY = 0;
+		m_nMouseWheel = 0;
+
+		m_sAppName = L"Default";
+
+		m_nPhaseInput = m_profiler.AddPhase(L"Input");
+		m_nPhaseUpdate = m_profiler.AddPhase(L"Update");
+		m_nPhasePresent = m_profiler.AddPhase(L"Present");
+	}
+
+	// Swap the platform layer, engine takes ownership. Must be called before ConstructConsole()
+	void SetBackend(ConsoleBackend* backend) {
+		m_pBackend.reset(backend);
+	}
+
+	// Feed a constant elapsed time to OnUserUpdate() rather than the real clock, which makes
+	// headless runs repeatable. 0 returns to real time
+	void SetFixedElapsedTime(float fElapsedTime) {
+		m_fFixedElapsedTime = fElapsedTime;
+	}
+
+	// Frames per second the game loop is paced to, 0 runs as fast as possible
+	void SetTargetFrameRate(float fFrameRate) {
+		m_fTargetFrameRate = fFrameRate;
+	}
+
+	// Threads in the worker pool besides the game thread, -1 picks one per spare core.
+	// Must be called before Start()
+	void SetWorkerThreads(int nThreads) {
+		m_nWorkerThreads = nThreads;
+	}
+
+	// Frame rate used instead while the application reports it is idle
+	void SetIdleFrameRate(float fFrameRate) {
+		m_fIdleFrameRate = fFrameRate;
+	}
+
+	int ConstructConsole(int width, int height, int fontw, int fonth) {
+		m_nScreenWidth = width;
+		m_nScreenHeight = height;
+
+		if (m_pBackend->Construct(width, height, fontw, fonth) != 1)
+			return Error(L"Backend Construct");
+
+		// Allocate memory for screen buffer
+		m_bufScreen = new CHAR_INFO[m_nScreenWidth * m_nScreenHeight];
+		memset(m_bufScreen, 0, sizeof(CHAR_INFO) * m_nScreenWidth * m_nScreenHeight);
+		ResetClipRect();
+
+		// And for the swap chain that carries finished frames over to the present thread
+		for (int i = 0; i < 3; i++) {
+			m_swapChain[i].buf = new CHAR_INFO[m_nScreenWidth * m_nScreenHeight];
+			memset(m_swapChain[i].buf, 0, sizeof(CHAR_INFO) * m_nScreenWidth * m_nScreenHeight);
+			m_swapChain[i].title[0] = 0;
+		}
+
+		return 1;
+	}
+
+	virtual void Draw(int x, int y, wchar_t c = 0x2588, short col = 0x000F) {
+		// 6/2/2019 Fixed mem overflow issue. Forgot to add y < m_nScreenHeight...
+		const sClipRect& clip = ClipRect();
+		if (x >= clip.x1 && x < clip.x2 && y >= clip.y1 && y < clip.y2) {
+			m_bufScreen[y * m_nScreenWidth + x].Char.UnicodeChar = c;
+			m_bufScreen[y * m_nScreenWidth + x].Attributes = col;
+		}
+	}
+
+	// Span primitives - everything below clips once per primitive (or once per row), then
+	// writes straight into contiguous screen memory with no further checks
+
+	// Horizontal run of cells from x1 up to but not including x2
+	void DrawSpan(int x1, int x2, int y, wchar_t c = 0x2588, short col = 0x000F) {
+		const sClipRect& clip = ClipRect();
+		if (y < clip.y1 || y >= clip.y2)
+			return;
+		x1 = max(x1, clip.x1);
+		x2 = min(x2, clip.x2);
+		if (x1 >= x2)
+			return;
+
+		CHAR_INFO ci;
+		ci.Char.UnicodeChar = c;
+		ci.Attributes = col;
+		fill_n(m_bufScreen + y * m_nScreenWidth + x1, x2 - x1, ci);
+	}
+
+	// Copy n ready made cells to a row, starting at x
+	void DrawSpan(int x, int y, const CHAR_INFO* src, int n) {
+		const sClipRect& clip = ClipRect();
+		if (y < clip.y1 || y >= clip.y2)
+			return;
+		int x1 = max(x, clip.x1);
+		int x2 = min(x + n, clip.x2);
+		if (x1 >= x2)
+			return;
+		memcpy(m_bufScreen + y * m_nScreenWidth + x1, src + (x1 - x), (x2 - x1) * sizeof(CHAR_INFO));
+	}
+
+	void Fill(int x1, int y1, int x2, int y2, wchar_t c = 0x2588, short col = 0x000F) {
+		const sClipRect& clip = ClipRect();
+		y1 = max(y1, clip.y1);
+		y2 = min(y2, clip.y2);
+		for (int y = y1; y < y2; y++)
+			DrawSpan(x1, x2, y, c, col);
+	}
+
+	void DrawString(int x, int y, wstring c, short col = 0x000F) {
+		int i1, i2;
+		if (!ClipString(x, y, (int)c.size(), i1, i2))
+			return;
+		CHAR_INFO* p = m_bufScreen + y * m_nScreenWidth + x;
+		for (int i = i1; i < i2; i++) {
+			p[i].Char.UnicodeChar = c[i];
+			p[i].Attributes = col;
+		}
+	}
+
+	void DrawStringAlpha(int x, int y, wstring c, short col = 0x000F) {
+		int i1, i2;
+		if (!ClipString(x, y, (int)c.size(), i1, i2))
+			return;
+		CHAR_INFO* p = m_bufScreen + y * m_nScreenWidth + x;
+		for (int i = i1; i < i2; i++) {
+			if (c[i] != L' ') {
+				p[i].Char.UnicodeChar = c[i];
+				p[i].Attributes = col;
+			}
+		}
+	}
+	// Clip buffer to prevent mem leak
+	void Clip(int& x, int& y) {
+		if (x < 0)
+			x = 0;
+		if (x >= m_nScreenWidth)
+			x = m_nScreenWidth;
+		if (y < 0)
+			y = 0;
+		if (y >= m_nScreenHeight)
+			y = m_nScreenHeight;
+	}
+
+	void DrawSprite(int x, int y, TemplateSprite* sprite) {
+		if (sprite == nullptr)
+			return;
+
+		DrawPartialSprite(x, y, sprite, 0, 0, sprite->nWidth, sprite->nHeight);
+	}
+
+	void DrawPartialSprite(int x, int y, TemplateSprite* sprite, int ox, int oy, int w, int h) {
+		if (sprite == nullptr)
+			return;
+
+		// Source area must lie within the sprite...
+		if (ox < 0) { x -= ox; w += ox; ox = 0; }
+		if (oy < 0) { y -= oy; h += oy; oy = 0; }
+		w = min(w, sprite->nWidth - ox);
+		h = min(h, sprite->nHeight - oy);
+
+		// ...and destination area within the clip
+		const sClipRect& clip = ClipRect();
+		int i1 = max(0, clip.x1 - x), i2 = min(w, clip.x2 - x);
+		int j1 = max(0, clip.y1 - y), j2 = min(h, clip.y2 - y);
+
+		for (int j = j1; j < j2; j++) {
+			const wchar_t* glyphs = sprite->GlyphRow(oy + j) + ox;
+			const short* colours = sprite->ColourRow(oy + j) + ox;
+			CHAR_INFO* p = m_bufScreen + (y + j) * m_nScreenWidth + x;
+			for (int i = i1; i < i2; i++)
+				if (glyphs[i] != L' ') {
+					p[i].Char.UnicodeChar = glyphs[i];
+					p[i].Attributes = colours[i];
+				}
+		}
+	}
+
+	void DrawWireFrameModel(const vector<pair<float, float>>& vecModelCoordinates, float x, float y, float r = 0.0f, float s = 1.0f, short col = FG_WHITE) {
+		// pair.first = x coordinate
+		// pair.second = y coordinate
+
+		// Inside a batch the model is just queued, otherwise it is a batch of one
+		bool bBatching = WireBatch().bActive;
+		if (!bBatching)
+			BeginWireFrameBatch();
+
+		if (!vecModelCoordinates.empty())
+			WireBatch().vecInstances.push_back({ &vecModelCoordinates, x, y, r, s, col });
+
+		if (!bBatching)
+			EndWireFrameBatch();
+	}
+
+	// Wireframe Batching
+	// Between Begin and End, DrawWireFrameModel() only records instances. End transforms
+	// every vertex of every instance in a single flat loop (rotation, scale and translation
+	// folded into one multiply-add per axis, sin/cos once per instance) into scratch arrays
+	// that are reused frame to frame, then draws the closed polygons with clip-once lines.
+	// Batches belong to the calling thread, so parallel bands can each run their own
+	void BeginWireFrameBatch() {
+		WireBatch().vecInstances.clear();
+		WireBatch().bActive = true;
+	}
+
+	void EndWireFrameBatch() {
+		sWireBatch& batch = WireBatch();
+		batch.bActive = false;
+
+		// Lay every vertex out flat alongside its instance's transform
+		size_t nVerts = 0;
+		for (auto& w : batch.vecInstances)
+			nVerts += w.model->size();
+		batch.scratch.Resize(nVerts);
+
+		size_t v = 0;
+		for (auto& w : batch.vecInstances) {
+			float c = cosf(w.r) * w.s;
+			float sn = sinf(w.r) * w.s;
+			for (auto& p : *w.model) {
+				batch.scratch.mx[v] = p.first;
+				batch.scratch.my[v] = p.second;
+				batch.scratch.c[v] = c;
+				batch.scratch.s[v] = sn;
+				batch.scratch.tx[v] = w.x;
+				batch.scratch.ty[v] = w.y;
+				v++;
+			}
+		}
+
+		// The transform itself, straight line code over plain float arrays so the compiler
+		// can vectorise it
+		float* __restrict mx = batch.scratch.mx.data();
+		float* __restrict my = batch.scratch.my.data();
+		const float* __restrict c = batch.scratch.c.data();
+		const float* __restrict sn = batch.scratch.s.data();
+		const float* __restrict tx = batch.scratch.tx.data();
+		const float* __restrict ty = batch.scratch.ty.data();
+		for (size_t i = 0; i < nVerts; i++) {
+			float x = mx[i] * c[i] - my[i] * sn[i] + tx[i];
+			float y = mx[i] * sn[i] + my[i] * c[i] + ty[i];
+			mx[i] = x;
+			my[i] = y;
+		}
+
+		// Closed polygons, skipping any instance whose bounds miss the clip entirely
+		const sClipRect& clip = ClipRect();
+		v = 0;
+		for (auto& w : batch.vecInstances) {
+			int verts = (int)w.model->size();
+			const float* px = mx + v;
+			const float* py = my + v;
+			v += verts;
+
+			float fMinX = px[0], fMaxX = px[0], fMinY = py[0], fMaxY = py[0];
+			for (int i = 1; i < verts; i++) {
+				fMinX = min(fMinX, px[i]); fMaxX = max(fMaxX, px[i]);
+				fMinY = min(fMinY, py[i]); fMaxY = max(fMaxY, py[i]);
+			}
+			if (fMaxX < clip.x1 || fMinX >= clip.x2 || fMaxY < clip.y1 || fMinY >= clip.y2)
+				continue;
+
+			for (int i = 0; i < verts; i++) {
+				int j = (i + 1) % verts;
+				DrawLine((int)px[i], (int)py[i], (int)px[j], (int)py[j], PIXEL_SOLID, w.col);
+			}
+		}
+	}
+
+	void DrawLine(int x1, int y1, int x2, int y2, wchar_t c = 0x2588, short col = 0x000F) {
+		// Straight lines are just spans
+		if (y1 == y2) {
+			DrawSpan(min(x1, x2), max(x1, x2) + 1, y1, c, col);
+			return;
+		}
+
+		// Clip once for the whole line: entirely off one side draws nothing, entirely
+		// inside needs no per pixel checks, only lines crossing an edge pay for them
+		const sClipRect& clip = ClipRect();
+		auto Outcode = [&](int x, int y) {
+			return (x < clip.x1 ? 1 : 0) | (x >= clip.x2 ? 2 : 0) | (y < clip.y1 ? 4 : 0) | (y >= clip.y2 ? 8 : 0);
+		};
+		int o1 = Outcode(x1, y1), o2 = Outcode(x2, y2);
+		if (o1 & o2)
+			return;
+		if ((o1 | o2) == 0)
+			RasterLine<false>(x1, y1, x2, y2, c, col);
+		else
+			RasterLine<true>(x1, y1, x2, y2, c, col);
+	}
+
+	// Bresenham, plotting through bChecked ? Draw() : an unchecked store
+	template<bool bChecked>
+	void RasterLine(int x1, int y1, int x2, int y2, wchar_t c, short col) {
+		auto Plot = [&](int x, int y) {
+			if (bChecked)
+				Draw(x, y, c, col);
+			else {
+				m_bufScreen[y * m_nScreenWidth + x].Char.UnicodeChar = c;
+				m_bufScreen[y * m_nScreenWidth + x].Attributes = col;
+			}
+		};
+
+
+		int x, y, dx, dy, dx1, dy1, px, py, xe, ye, i;
+		dx = x2 - x1;
+		dy = y2 - y1;
+		dx1 = abs(dx);
+		dy1 = abs(dy);
+		px = 2 * dy1 - dx1;
+		py = 2 * dx1 - dy1;
+		if (dy1 <= dx1) {
+			if (dx >= 0) {
+				x = x1;
+				y = y1;
+				xe = x2;
+			}
+
+			else {
+				x = x2;
+				y = y2;
+				xe = x1;
+			}
+
+			Plot(x, y);
+			for (int i = 0; x < xe; i++) {
+				x = x + 1;
+				if (px < 0)
+					px = px + 2 * dy1;
+				else {
+					if ((dx < 0 && dy < 0) || (dx > 0 && dy > 0))
+						y = y + 1;
+					else
+						y = y - 1;
+					px = px + 2 * (dy1 - dx1);
+				}
+
+				Plot(x, y);
+			}
+		}
+
+		else {
+			if (dy >= 0) {
+				x = x1;
+				y = y1;
+				ye = y2;
+			}
+
+			else {
+				x = x2;
+				y = y2;
+				ye = y1;
+			}
+
+			Plot(x, y);
+			for (i = 0; y < ye; i++) {
+				y = y + 1;
+				if (py <= 0)
+					py = py + 2 * dx1;
+				else {
+					if ((dx < 0 && dy < 0) || (dx > 0 && dy > 0))
+						x = x + 1;
+					else
+						x = x - 1;
+					py = py + 2 * (dx1 - dy1);
+				}
+
+				Plot(x, y);
+			}
+		}
+	}
+
+	~ConsoleTemplateEngine() {
+		m_pBackend->Restore();
+		delete[] m_bufScreen;
+		for (int i = 0; i < 3; i++)
+			delete[] m_swapChain[i].buf;
+	}
+
+public:
+	void Start() {
+		m_bAtomActive = true;
+
+		// Start the threads, presentation runs on its own so a slow terminal can never
+		// hold up the simulation, and the backend reads input on one of its own
+		m_pBackend->StartInput(&m_inputQueue);
+		m_workers.Start(m_nWorkerThreads >= 0 ? m_nWorkerThreads : max(0, (int)thread::hardware_concurrency() - 1));
+		m_bPresentOnGameThread = m_pBackend->PresentOnGameThread();
+		thread t = thread(&ConsoleTemplateEngine::GameThread, this);
+		thread p;
+		if (!m_bPresentOnGameThread)
+			p = thread(&ConsoleTemplateEngine::PresentThread, this);
+
+		// Wait for thread to exit. Joining rather than waiting on m_cvGameFinished, short
+		// headless runs can finish before a wait would begin and miss the notify
+		t.join();
+
+		// Wake the present thread so it sees the game has ended
+		{
+			lock_guard<mutex> lock(m_muxPresent);
+		}
+		m_cvPresent.notify_one();
+		if (p.joinable())
+			p.join();
+
+		m_pBackend->StopInput();
+		m_workers.Stop();
+	}
+
+	// Frames completed by the simulation that the present thread never got to show
+	int DroppedFrames() {
+		return m_nDroppedFrames;
+	}
+
+	int ScreenWidth() {
+		return m_nScreenWidth;
 	}
 
 	int ScreenHeight() {
@@ -575,102 +2118,155 @@ private:
 		if (!OnUserCreate())
 			m_bAtomActive = false;
 
-		auto tp1 = chrono::system_clock::now();
-		auto tp2 = chrono::system_clock::now();
+		// Steady clock, wall clock adjustments must not turn into huge or negative frame times
+		auto tp1 = chrono::steady_clock::now();
+		auto tp2 = chrono::steady_clock::now();
+		auto tpNextFrame = tp1;
 
-		// Run fast as possible
 		while (m_bAtomActive) {
+			// Pace to the target frame rate, or the idle rate if nothing is happening
+			float fFrameRate = m_bIdle ? m_fIdleFrameRate : m_fTargetFrameRate;
+			if (fFrameRate > 0.0f) {
+				auto tpPeriod = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<float>(1.0f / fFrameRate));
+				tpNextFrame += tpPeriod;
+
+				// Fell more than a frame behind, don't try to catch up with a burst
+				auto tpNow = chrono::steady_clock::now();
+				if (tpNextFrame < tpNow - tpPeriod)
+					tpNextFrame = tpNow;
+
+				WaitUntil(tpNextFrame);
+			}
+
 			// Handle Timing
-			tp2 = chrono::system_clock::now();
+			tp2 = chrono::steady_clock::now();
 			chrono::duration<float> elapsedTime = tp2 - tp1;
 			tp1 = tp2;
-			float fElapsedTime = elapsedTime.count();
+			float fElapsedTime = m_fFixedElapsedTime > 0.0f ? m_fFixedElapsedTime : elapsedTime.count();
 
-			// Handle Keyboard Input
-			for (int i = 0; i < 256; i++) {
-				m_keyNewState[i] = GetAsyncKeyState(i);
+			// Handle Input - Apply everything that happened since the last frame
+			auto tpInput = chrono::steady_clock::now();
+			m_pBackend->PollInput();
 
+			for (int i = 0; i < 256; i++) {
 				m_keys[i].bPressed = false;
 				m_keys[i].bReleased = false;
+			}
+			for (int m = 0; m < 5; m++) {
+				m_mouse[m].bPressed = false;
+				m_mouse[m].bReleased = false;
+			}
+			m_nMouseWheel = 0;
 
-				if (m_keyNewState[i] != m_keyOldState[i]) {
-					if (m_keyNewState[i] & 0x8000) {
-						m_keys[i].bPressed = !m_keys[i].bHeld;
-						m_keys[i].bHeld = true;
-					}
-
-					else {
-						m_keys[i].bReleased = true;
-						m_keys[i].bHeld = false;
-					}
+			sInputEvent e;
+			while (m_inputQueue.Pop(e)) {
+				switch (e.nType) {
+				case INPUT_KEY:
+					ApplyButtonEvent(m_keys[e.nCode & 0xFF], e.bDown);
+					break;
+				case INPUT_MOUSE_BUTTON:
+					if (e.nCode >= 0 && e.nCode < 5)
+						ApplyButtonEvent(m_mouse[e.nCode], e.bDown);
+					break;
+				case INPUT_MOUSE_MOVE:
+					m_mousePosX = e.x;
+					m_mousePosY = e.y;
+					break;
+				case INPUT_MOUSE_WHEEL:
+					m_nMouseWheel += e.nCode;
+					break;
 				}
-
-				m_keyOldState[i] = m_keyNewState[i];
 			}
+			m_profiler.AddTimeSince(m_nPhaseInput, tpInput);
 
+			// F3 toggles the profiler overlay in any game
+			if (m_keys[VK_F3].bPressed)
+				m_bShowProfiler = !m_bShowProfiler;
 
-			// Handle Mouse Input - Check for window events
-			INPUT_RECORD inBuf[32];
-			DWORD events = 0;
-			GetNumberOfConsoleInputEvents(m_hConsoleIn, &events);
-			if (events > 0)
-				ReadConsoleInput(m_hConsoleIn, inBuf, events, &events); // Blocking
+			// Handle Frame Update
+			{
+				ProfileScope scope(m_profiler, m_nPhaseUpdate);
+				if (!OnUserUpdate(fElapsedTime))
+					m_bAtomActive = false;
+			}
 
-			// Handle events - we only care about mouse clicks and movement for this update // We dont have an event based system, so being emulated to appear like it in background
-			for (DWORD i = 0; i < events; i++) {
-				switch (inBuf[i].EventType) {
-				case MOUSE_EVENT:
-					switch (inBuf[i].Event.MouseEvent.dwEventFlags) {
-					case MOUSE_MOVED:
-						m_mousePosX = inBuf[i].Event.MouseEvent.dwMousePosition.X;
-						m_mousePosY = inBuf[i].Event.MouseEvent.dwMousePosition.Y;
-						break;
-					case 0:
-						for (int m = 0; m < 5; m++) {
-							m_mouseNewState[m] = (inBuf[i].Event.MouseEvent.dwButtonState & (1 << m)) > 0;
-						}
-						break;
-					default:
-						break;
-					}
-					break;
+			// Present is timed on whichever thread does it, take the latest result
+			m_profiler.AddTime(m_nPhasePresent, m_fPresentTime);
+			m_profiler.EndFrame();
+
+			if (m_bShowProfiler)
+				m_profiler.DrawOverlay(this, max(0, m_nScreenWidth - m_profiler.OverlayWidth()), 0);
+
+			// Update Title & Present Screen Buffer. The title is a system call (or a
+			// terminal escape) of its own, so only refresh it twice a second
+			sFrame& frame = m_swapChain[m_nBackFrame];
+			m_fTitleTimer += fElapsedTime;
+			m_nTitleFrames++;
+			frame.bTitle = m_fTitleTimer >= 0.5f;
+			if (frame.bTitle) {
+				swprintf_s(frame.title, 128, L"OneLoneCoder.com - Console Game Engine - %ls - FPS: %3.2f", m_sAppName.c_str(), m_nTitleFrames / m_fTitleTimer);
+				m_fTitleTimer = 0.0f;
+				m_nTitleFrames = 0;
+			}
 
-				default:
-					break;
-					//Dont care at the moment
+			if (m_bPresentOnGameThread) {
+				auto tpPresent = chrono::steady_clock::now();
+				if (frame.bTitle)
+					m_pBackend->SetTitle(frame.title);
+				if (!m_pBackend->Present(m_bufScreen, m_nScreenWidth, m_nScreenHeight))
+					m_bAtomActive = false;
+				m_fPresentTime = chrono::duration<float, milli>(chrono::steady_clock::now() - tpPresent).count();
+			}
+			else {
+				// Hand the frame over to the present thread. This never waits, if the last
+				// frame handed over has not been picked up yet it is simply replaced
+				memcpy(frame.buf, m_bufScreen, sizeof(CHAR_INFO) * m_nScreenWidth * m_nScreenHeight);
+				int nOld = m_nReadyFrame.exchange(m_nBackFrame | FRAME_FRESH);
+				if (nOld & FRAME_FRESH)
+					m_nDroppedFrames++;
+				m_nBackFrame = nOld & FRAME_INDEX;
+
+				{
+					lock_guard<mutex> lock(m_muxPresent);
 				}
+				m_cvPresent.notify_one();
 			}
+		}
 
-			for (int m = 0; m < 5; m++) {
-				m_mouse[m].bPressed = false;
-				m_mouse[m].bReleased = false;
+		m_cvGameFinished.notify_one();
+	}
 
-				if (m_mouseNewState[m] != m_mouseOldState[m]) {
-					if (m_mouseNewState[m]) {
-						m_mouse[m].bPressed = true;
-						m_mouse[m].bHeld = true;
-					}
-					else {
-						m_mouse[m].bReleased = true;
-						m_mouse[m].bHeld = false;
-					}
-				}
+	// Sleep most of the way as sleeps are coarse and can overshoot, then spin out the rest
+	void WaitUntil(chrono::steady_clock::time_point tp) {
+		const auto tpSpin = chrono::milliseconds(2);
+		auto tpNow = chrono::steady_clock::now();
+		if (tp - tpNow > tpSpin)
+			this_thread::sleep_for(tp - tpNow - tpSpin);
+		while (chrono::steady_clock::now() < tp)
+			this_thread::yield();
+	}
 
-				m_mouseOldState[m] = m_mouseNewState[m];
+	void PresentThread() {
+		while (m_bAtomActive) {
+			{
+				unique_lock<mutex> lock(m_muxPresent);
+				m_cvPresent.wait(lock, [&] { return (m_nReadyFrame & FRAME_FRESH) || !m_bAtomActive; });
 			}
 
-			// Handle Frame Update
-			if (!OnUserUpdate(fElapsedTime))
-				m_bAtomActive = false;
+			if (!m_bAtomActive)
+				break;
 
-			// Update Title & Present Screen Buffer
-			wchar_t s[128];
-			swprintf_s(s, 128, L"OneLoneCoder.com - Console Game Engine - %s - FPS: %3.2f - %d ", m_sAppName.c_str(), 1.0f / fElapsedTime, events);
-			SetConsoleTitle(s);
-			WriteConsoleOutput(m_hConsole, m_bufScreen, { (short)m_nScreenWidth, (short)m_nScreenHeight }, { 0, 0 }, &m_rectWindow);
-		}
+			// Swap the newest finished frame in for the one we showed last
+			m_nFrontFrame = m_nReadyFrame.exchange(m_nFrontFrame) & FRAME_INDEX;
 
-		m_cvGameFinished.notify_one();
+			auto tpPresent = chrono::steady_clock::now();
+			sFrame& frame = m_swapChain[m_nFrontFrame];
+			if (frame.bTitle)
+				m_pBackend->SetTitle(frame.title);
+			if (!m_pBackend->Present(frame.buf, m_nScreenWidth, m_nScreenHeight))
+				m_bAtomActive = false;
+			m_fPresentTime = chrono::duration<float, milli>(chrono::steady_clock::now() - tpPresent).count();
+		}
 	}
 
 public:
@@ -678,10 +2274,87 @@ public:
 	virtual bool OnUserCreate() = 0;
 	virtual bool OnUserUpdate(float fElapsedTime) = 0;
 
+protected:
+	// Area of the screen that drawing is confined to, x2 and y2 exclusive
+	struct sClipRect {
+		int x1, y1, x2, y2;
+	};
+
+	// A band being drawn in parallel has its own clip on its own thread
+	const sClipRect& ClipRect() {
+		sClipRect* pBand = BandClip();
+		return pBand != nullptr ? *pBand : m_clip;
+	}
+
+	static sClipRect*& BandClip() {
+		static thread_local sClipRect* pClip = nullptr;
+		return pClip;
+	}
+
+	// Split the screen into horizontal bands and call fn(nBand, y1, y2) for each in parallel
+	// on the worker pool. Drawing inside fn is confined to rows y1 up to y2, so bands can't
+	// tread on each other; wireframe batches are per thread and safe to use too
+	int BandCount() {
+		return min(m_nScreenHeight, m_workers.Concurrency() > 1 ? m_workers.Concurrency() * 4 : 1);
+	}
+
+	// Band screen row y is drawn in, rows off the screen count as the nearest band
+	int BandOf(int y) {
+		y = max(0, min(y, m_nScreenHeight - 1));
+		return ((y + 1) * BandCount() - 1) / m_nScreenHeight;
+	}
+
+	void ParallelBands(const function<void(int, int, int)>& fn) {
+		int nBands = BandCount();
+		m_workers.ParallelFor(nBands, [&](int nBand) {
+			int y1 = m_nScreenHeight * nBand / nBands;
+			int y2 = m_nScreenHeight * (nBand + 1) / nBands;
+			sClipRect clip = { m_clip.x1, max(m_clip.y1, y1), m_clip.x2, min(m_clip.y2, y2) };
+			BandClip() = &clip;
+			fn(nBand, y1, y2);
+			BandClip() = nullptr;
+		});
+	}
+
+	// How many ranges to split a loop over n items into, none smaller than nMinPerRange so a
+	// short loop stays on the calling thread rather than waking the pool
+	int RangeCount(int n, int nMinPerRange) {
+		int nMax = m_workers.Concurrency() > 1 ? m_workers.Concurrency() * 4 : 1;
+		return max(1, min(nMax, n / max(1, nMinPerRange)));
+	}
+
+	// Call fn(nRange, i1, i2) on the worker pool for each of nRanges even slices of items 0 up
+	// to n. Ranges finish in any order, but anything gathered per range and joined in range
+	// order comes out just as a serial loop would have left it
+	void ParallelRanges(int nRanges, int n, const function<void(int, int, int)>& fn) {
+		m_workers.ParallelFor(nRanges, [&](int nRange) {
+			fn(nRange, (int)((long long)n * nRange / nRanges), (int)((long long)n * (nRange + 1) / nRanges));
+		});
+	}
+
+	void SetClipRect(int x1, int y1, int x2, int y2) {
+		m_clip = { max(0, x1), max(0, y1), min(m_nScreenWidth, x2), min(m_nScreenHeight, y2) };
+	}
+
+	void ResetClipRect() {
+		m_clip = { 0, 0, m_nScreenWidth, m_nScreenHeight };
+	}
+
+	// Visible range [i1, i2) of an n character string at x, y
+	bool ClipString(int x, int y, int n, int& i1, int& i2) {
+		const sClipRect& clip = ClipRect();
+		if (y < clip.y1 || y >= clip.y2)
+			return false;
+		i1 = max(0, clip.x1 - x);
+		i2 = min(n, clip.x2 - x);
+		return i1 < i2;
+	}
+
 protected:
 	int m_nScreenWidth;
 	int m_nScreenHeight;
 	CHAR_INFO* m_bufScreen;
+	sClipRect m_clip = { 0, 0, 0, 0 };
 	atomic<bool> m_bAtomActive;
 	condition_variable m_cvGameFinished;
 	mutex m_muxGame;
@@ -695,23 +2368,95 @@ protected:
 
 	int m_mousePosX;
 	int m_mousePosY;
+	int m_nMouseWheel;	// Wheel notches this frame, positive away from the user
+
+	// Set by the application while nothing on screen is changing, the loop then drops to
+	// the idle frame rate so a waiting game costs next to no CPU
+	bool m_bIdle = false;
+
+	// Per phase frame timings, applications add their own phases and counters
+	FrameProfiler m_profiler;
+
+	// Threads for parallel loops, available from OnUserCreate() on
+	WorkerPool m_workers;
+	int m_nWorkerThreads = -1;
+	bool m_bShowProfiler = false;
 
 protected:
 	int Error(const wchar_t* msg) {
-		wchar_t buf[256];
-		FormatMessage(FORMAT_MESSAGE_FROM_SYSTEM, NULL, GetLastError(), MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), buf, 256, NULL);
-		SetConsoleActiveScreenBuffer(m_hOriginalConsole);
+		m_pBackend->Restore();
 		return -1;
 	}
 
 private:
-	HANDLE m_hOriginalConsole;
-	CONSOLE_SCREEN_BUFFER_INFO m_OriginalConsoleInfo;
-	HANDLE m_hConsole;
-	HANDLE m_hConsoleIn;
-	SMALL_RECT m_rectWindow;
-	short* m_keyOldState;
-	short* m_keyNewState;
-	bool m_mouseOldState[5];
-	bool m_mouseNewState[5];
+	// A press and release in the same frame leaves both flags set, so short taps are never lost
+	void ApplyButtonEvent(sKeyState& key, bool bDown) {
+		if (bDown) {
+			key.bPressed = key.bPressed || !key.bHeld;
+			key.bHeld = true;
+		}
+		else if (key.bHeld) {
+			key.bReleased = true;
+			key.bHeld = false;
+		}
+	}
+
+	unique_ptr<ConsoleBackend> m_pBackend;
+	float m_fFixedElapsedTime;
+	float m_fTargetFrameRate = 60.0f;
+	float m_fIdleFrameRate = 10.0f;
+
+	// Triple buffered swap chain between game and present threads. The game thread owns
+	// the back frame, the present thread owns the front one, and the ready frame sits in
+	// between flagged fresh until the present thread swaps it out
+	struct sFrame {
+		CHAR_INFO* buf = nullptr;
+		wchar_t title[128];
+		bool bTitle = false;
+	} m_swapChain[3];
+	static const int FRAME_INDEX = 0x3;
+	static const int FRAME_FRESH = 0x4;
+	int m_nBackFrame = 0;
+	atomic<int> m_nReadyFrame{ 1 };
+	int m_nFrontFrame = 2;
+	atomic<int> m_nDroppedFrames{ 0 };
+	bool m_bPresentOnGameThread = false;
+	float m_fTitleTimer = 0.0f;
+	int m_nTitleFrames = 0;
+	int m_nPhaseInput;
+	int m_nPhaseUpdate;
+	int m_nPhasePresent;
+	atomic<float> m_fPresentTime{ 0.0f };
+	mutex m_muxPresent;
+	condition_variable m_cvPresent;
+	InputQueue m_inputQueue;
+
+	struct sWireFrame {
+		const vector<pair<float, float>>* model;
+		float x, y, r, s;
+		short col;
+	};
+
+	// Flat per vertex arrays, model coordinates in and screen coordinates out of mx/my
+	struct sWireScratch {
+		vector<float> mx, my, c, s, tx, ty;
+
+		// Only ever grows, so steady state frames don't allocate
+		void Resize(size_t n) {
+			if (mx.size() >= n)
+				return;
+			mx.resize(n); my.resize(n); c.resize(n); s.resize(n); tx.resize(n); ty.resize(n);
+		}
+	};
+
+	struct sWireBatch {
+		vector<sWireFrame> vecInstances;
+		sWireScratch scratch;
+		bool bActive = false;
+	};
+
+	static sWireBatch& WireBatch() {
+		static thread_local sWireBatch batch;
+		return batch;
+	}
 };
\ No newline at end of file
@@ -2,15 +2,37 @@ using namespace std;
 
 #include <algorithm>
 #include <string>
+#include <cstdint>
 #include "ConsoleEngine.h"
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Index of the lowest set bit, v must not be 0
+static inline int CountTrailingZeros(uint64_t v) {
+#ifdef _MSC_VER
+	unsigned long n;
+	_BitScanForward64(&n, v);
+	return (int)n;
+#else
+	return __builtin_ctzll(v);
+#endif
+}
+
 class cPhysicsObject {
 public:
 	cPhysicsObject(float x = 0.0f, float y = 0.0f) {
 		px = x;
 		py = y;
+		lx = x;
+		ly = y;
 	}
 
+	// Where to draw, fAlpha of the way from the position before the last physics tick to now
+	float DrawX(float fAlpha) const { return lx + (px - lx) * fAlpha; }
+	float DrawY(float fAlpha) const { return ly + (py - ly) * fAlpha; }
+
 public:
 	float px = 0.0f;				// Position
 	float py = 0.0f;
@@ -18,6 +40,8 @@ public:
 	float vy = 0.0f;
 	float ax = 0.0f;				// Acceleration
 	float ay = 0.0f;
+	float lx = 0.0f;				// Position before the last physics tick
+	float ly = 0.0f;
 
 	float radius = 4.0f;			// Bounding rectangle for collisions
 	float fFriction = 0.0f;			// Actually, a dampening factor is a more accurate name
@@ -25,6 +49,8 @@ public:
 	int nBounceBeforeDeath = -1;	// How many time object can bounce before death
 	bool bDead;						// Flag to indicate object should be removed
 	bool bStable = false;			// Has object stopped moving
+	bool bAsleep = false;			// At rest and left out of physics until something disturbs it
+	float fRestTime = 0.0f;			// Game time it has been stable without a break
 
 	// Make class abstract
 	virtual void Draw(ConsoleTemplateEngine* engine, float fOffsetX, float fOffsetY, bool bPixel = false) = 0; // Pointer to engine allows instance of game engine into object code // offset is camera position
@@ -32,36 +58,6 @@ public:
 	virtual bool Damage(float d) = 0;
 };
 
-class cDebris : public cPhysicsObject {
-public:
-	cDebris(float x = 0.0f, float y = 0.0f) : cPhysicsObject(x, y) {
-		// Set velocity to random direction and size for "boom" effect
-		vx = 10.0f * cosf(((float)rand() / (float)RAND_MAX) * 2.0f * 3.14159f);
-		vy = 10.0f * sinf(((float)rand() / (float)RAND_MAX) * 2.0f * 3.14159f);
-		radius = 1.0f;
-		fFriction = 0.8f;
-		bDead = false;
-		bStable = false;
-		nBounceBeforeDeath = 2; // After 2 bounces, dispose
-	}
-
-	virtual void Draw(ConsoleTemplateEngine* engine, float fOffsetX, float fOffsetY, bool bPixel = false) {
-		engine->DrawWireFrameModel(vecModel, px - fOffsetX, py - fOffsetY, atan2f(vy, vx), bPixel ? 0.5f : radius, FG_DARK_GREEN);
-	}
-
-	virtual int BounceDeathAction() {
-		return 0; // Nothing, just fade
-	}
-
-	virtual bool Damage(float d) {
-		return true; // Cannot be damaged
-	}
-
-private:
-	static vector<pair<float, float>> vecModel;
-
-};
-
 vector<pair<float, float>> DefineDebris() {
 	// A small unit rectangle
 	vector<pair<float, float>> vecModel;
@@ -72,7 +68,6 @@ vector<pair<float, float>> DefineDebris() {
 	return vecModel;
 }
 
-vector<pair<float, float>> cDebris::vecModel = DefineDebris();
 
 // Help debug physics object // inherites from cPhysicsObject
 /*class cDummy : public cPhysicsObject {
@@ -179,10 +174,9 @@ public:
 			engine->DrawPartialSprite(px - fOffsetX - radius, py - fOffsetY - radius, sprWorm, nTeam * 8, 0, 8, 8);
 
 			// Draw health bar for worm
-			for (int i = 0; i < 11 * fHealth; i++) {
-				engine->Draw(px - 5 + i - fOffsetX, py + 5 - fOffsetY, PIXEL_SOLID, FG_BLUE);
-				engine->Draw(px - 5 + i - fOffsetX, py + 6 - fOffsetY, PIXEL_SOLID, FG_BLUE);
-			}
+			int nBar = (int)ceilf(11 * fHealth);
+			engine->DrawSpan(px - 5 - fOffsetX, px - 5 - fOffsetX + nBar, py + 5 - fOffsetY, PIXEL_SOLID, FG_BLUE);
+			engine->DrawSpan(px - 5 - fOffsetX, px - 5 - fOffsetX + nBar, py + 6 - fOffsetY, PIXEL_SOLID, FG_BLUE);
 		}
 
 		else { // Draw tombstone sprite for team colour
@@ -217,41 +211,953 @@ TemplateSprite* cWorm::sprWorm = nullptr;
 
 class cTeam { // Defines a group of worms
 public:
-	vector<cWorm*> vecMembers;
+	vector<SlotHandle> vecMembers;	// Handles into the game's worm pool, stale once a worm is gone
 	int nCurrentMember = 0;	//Index into vector for current worms turn
 	int nTeamSize = 0;		// Total number of worms in team
 
-	bool IsTeamAlive() {
+	// A member that has left the pool counts as dead
+	static bool IsAlive(SlotMap<cWorm>& worms, SlotHandle h) {
+		cWorm* w = worms.Get(h);
+		return w != nullptr && w->fHealth > 0.0f;
+	}
+
+	bool IsTeamAlive(SlotMap<cWorm>& worms) {
 		// Iterate through all team members, if any of them have > 0 health, return true;
 		bool bAllDead = false;
-		for (auto w : vecMembers)
-			bAllDead |= (w->fHealth > 0.0f);
+		for (auto h : vecMembers)
+			bAllDead |= IsAlive(worms, h);
 		return bAllDead;
 	}
 
-	cWorm* GetNextMember() {
-		// Return a point to the next team member that is valid for control
+	SlotHandle GetNextMember(SlotMap<cWorm>& worms) {
+		// Return a handle to the next team member that is valid for control
 		do {
 			nCurrentMember++;
 			if (nCurrentMember >= nTeamSize)
 				nCurrentMember = 0;
-		} while (vecMembers[nCurrentMember]->fHealth <= 0);
+		} while (!IsAlive(worms, vecMembers[nCurrentMember]));
 		return vecMembers[nCurrentMember];
 	}
 
 };
 
+// Terrain is one bit per pixel, set for land, kept in 64x64 pixel chunks so that a chunk
+// row is a single 64 bit word with pixel x at bit x & 63. Chunks that are all sky or all
+// land point at one shared chunk of each kind, only those along the surface and around
+// craters get memory of their own, allocated on first write and given back once uniform.
+// Each chunk also carries a pyramid of land coverage, 0..255, at 1/2 down to 1/64 size
+// for drawing the terrain zoomed out.
+// Alongside the chunks is a signed distance field, the distance from each pixel to the
+// surface, positive in sky and negative in land, kept to within FIELD_RANGE of it. Only
+// chunks with surface within that range of them hold a tile of the field
+class cTerrain {
+public:
+	static constexpr int CHUNK = 64;
+	static const int MIP_LEVELS = 7;	// Level 0 is the bitmap itself
+	static const int FIELD_APRON = 8;	// Pixels around a chunk that can affect its field
+	static constexpr float FIELD_SCALE = 16.0f;
+	static constexpr float FIELD_RANGE = 127.0f / FIELD_SCALE;
+
+	cTerrain() {}
+	~cTerrain() {
+		Free();
+	}
+
+	cTerrain(const cTerrain&) = delete;
+	cTerrain& operator=(const cTerrain&) = delete;
+
+	// All sky
+	void Create(int nWidth, int nHeight) {
+		Free();
+		m_nWidth = nWidth;
+		m_nHeight = nHeight;
+		m_nChunksX = (nWidth + CHUNK - 1) / CHUNK;
+		m_nChunksY = (nHeight + CHUNK - 1) / CHUNK;
+		m_vecChunks.assign(m_nChunksX * m_nChunksY, Empty());
+		m_vecField.resize(m_nChunksX * m_nChunksY);
+	}
+
+	int Width() const { return m_nWidth; }
+	int Height() const { return m_nHeight; }
+	int ChunksX() const { return m_nChunksX; }
+	int ChunksY() const { return m_nChunksY; }
+	int AllocatedChunks() const { return m_nAllocated; }
+
+	// Whether a chunk is known to be all sky or all land, and which
+	bool IsUniform(int cx, int cy, bool& bSolid) const {
+		const sChunk* chunk = m_vecChunks[cy * m_nChunksX + cx];
+		bSolid = chunk == Full();
+		return IsShared(chunk);
+	}
+
+	// Word w of row y, covering pixels w * 64 up to w * 64 + 64
+	uint64_t Word(int w, int y) const {
+		return m_vecChunks[(y / CHUNK) * m_nChunksX + w]->rows[y % CHUNK];
+	}
+
+	bool IsSolid(int x, int y) const {
+		return (Word(x >> 6, y) >> (x & 63)) & 1;
+	}
+
+	// Bits of word w that lie in x1 up to x2
+	static uint64_t SpanMask(int w, int x1, int x2) {
+		uint64_t mask = ~0ull;
+		if (w == x1 >> 6)
+			mask &= ~0ull << (x1 & 63);
+		if (w == (x2 - 1) >> 6)
+			mask &= ~0ull >> (63 - ((x2 - 1) & 63));
+		return mask;
+	}
+
+	// Any land in the box x1 up to x2, y1 up to y2, a word at a time
+	bool AnySolid(int x1, int y1, int x2, int y2) const {
+		for (int y = y1; y < y2; y++)
+			for (int w = x1 >> 6; w <= (x2 - 1) >> 6; w++)
+				if (Word(w, y) & SpanMask(w, x1, x2))
+					return true;
+		return false;
+	}
+
+	bool AllSolid(int x1, int y1, int x2, int y2) const {
+		for (int y = y1; y < y2; y++)
+			for (int w = x1 >> 6; w <= (x2 - 1) >> 6; w++) {
+				uint64_t mask = SpanMask(w, x1, x2);
+				if ((Word(w, y) & mask) != mask)
+					return false;
+			}
+		return true;
+	}
+
+	// Clears x1 up to x2 on row y, clipped to the map
+	void ClearSpan(int x1, int x2, int y) {
+		x1 = max(x1, 0);
+		x2 = min(x2, m_nWidth);
+		if (y < 0 || y >= m_nHeight || x1 >= x2)
+			return;
+
+		for (int w = x1 >> 6; w <= (x2 - 1) >> 6; w++) {
+			uint64_t mask = SpanMask(w, x1, x2);
+			if ((Word(w, y) & mask) == 0)
+				continue;
+
+			sChunk* chunk = Writable(w, y);
+			chunk->rows[y % CHUNK] &= ~mask;
+			if (!chunk->bDirty) {
+				chunk->bDirty = true;
+				m_vecDirty.push_back((y / CHUNK) * m_nChunksX + w);
+			}
+			if (chunk->rows[y % CHUNK] == 0)
+				ShareIfUniform(w, y);
+		}
+	}
+
+	// Coverage pyramids and the distance field around chunks changed by ClearSpan() are
+	// stale until this is called
+	void Update() {
+		vector<int> vecField;
+		for (int i : m_vecDirty) {
+			sChunk* chunk = m_vecChunks[i];
+			if (!IsShared(chunk) && chunk->bDirty)
+				BuildMips(chunk);
+
+			// The apron is less than a chunk, so only the chunks around can see the change
+			int cx = i % m_nChunksX, cy = i / m_nChunksX;
+			for (int ny = max(cy - 1, 0); ny <= min(cy + 1, m_nChunksY - 1); ny++)
+				for (int nx = max(cx - 1, 0); nx <= min(cx + 1, m_nChunksX - 1); nx++)
+					vecField.push_back(ny * m_nChunksX + nx);
+		}
+		m_vecDirty.clear();
+
+		sort(vecField.begin(), vecField.end());
+		vecField.erase(unique(vecField.begin(), vecField.end()), vecField.end());
+		for (int i : vecField)
+			BuildField(i % m_nChunksX, i / m_nChunksX);
+	}
+
+	// Signed distance from the middle of pixel x, y to the surface, off the map edges
+	// carries on as the edge pixels do
+	float Field(int x, int y) const {
+		x = max(0, min(x, m_nWidth - 1));
+		y = max(0, min(y, m_nHeight - 1));
+		const sField* tile = m_vecField[(y / CHUNK) * m_nChunksX + x / CHUNK].get();
+		if (tile == nullptr)
+			return IsSolid(x, y) ? -FIELD_RANGE : FIELD_RANGE;
+		return tile->d[(y % CHUNK) * CHUNK + x % CHUNK] / FIELD_SCALE;
+	}
+
+	// Distance from x, y to the surface and the unit normal pointing out of the land, from
+	// a bilinear blend of the four nearest pixels. The normal is 0, 0 where the field is
+	// flat, deeper than FIELD_RANGE in land or sky
+	float Distance(float x, float y, float& nx, float& ny) const {
+		float gx = x - 0.5f, gy = y - 0.5f;
+		int x0 = (int)floorf(gx), y0 = (int)floorf(gy);
+		float tx = gx - x0, ty = gy - y0;
+
+		float d00 = Field(x0, y0), d10 = Field(x0 + 1, y0);
+		float d01 = Field(x0, y0 + 1), d11 = Field(x0 + 1, y0 + 1);
+
+		float dx = (d10 - d00) * (1.0f - ty) + (d11 - d01) * ty;
+		float dy = (d01 - d00) * (1.0f - tx) + (d11 - d10) * tx;
+		float fLength = sqrtf(dx * dx + dy * dy);
+		nx = fLength > 0.0001f ? dx / fLength : 0.0f;
+		ny = fLength > 0.0001f ? dy / fLength : 0.0f;
+
+		float d0 = d00 + (d10 - d00) * tx;
+		float d1 = d01 + (d11 - d01) * tx;
+		return d0 + (d1 - d0) * ty;
+	}
+
+	// Walks the pixels the segment from x0, y0 to x1, y1 passes through, in order, and stops
+	// at the first one of land. On a hit hx, hy is where the segment enters that pixel and
+	// nx, ny the outward normal of the side it came in by, 0, 0 if it started in land. The
+	// map's edges are open, so a segment leaving the map hits nothing
+	bool RayMarch(float x0, float y0, float x1, float y1, float& hx, float& hy, float& nx, float& ny) const {
+		float dx = x1 - x0, dy = y1 - y0;
+		int x = (int)floorf(x0), y = (int)floorf(y0);
+		int xEnd = (int)floorf(x1), yEnd = (int)floorf(y1);
+		int sx = dx > 0.0f ? 1 : -1;
+		int sy = dy > 0.0f ? 1 : -1;
+
+		// Ray parameter t runs 0..1 along the segment, these are the steps in t between pixel
+		// edges and the t of the next edge on each axis
+		const float fNever = 1e30f;
+		float tDeltaX = dx != 0.0f ? fabsf(1.0f / dx) : fNever;
+		float tDeltaY = dy != 0.0f ? fabsf(1.0f / dy) : fNever;
+		float tNextX = dx != 0.0f ? (dx > 0.0f ? x + 1 - x0 : x0 - x) * tDeltaX : fNever;
+		float tNextY = dy != 0.0f ? (dy > 0.0f ? y + 1 - y0 : y0 - y) * tDeltaY : fNever;
+
+		float t = 0.0f;
+		nx = 0.0f;
+		ny = 0.0f;
+		while (true) {
+			if (x < 0 || x >= m_nWidth || y < 0 || y >= m_nHeight)
+				return false;
+
+			if (IsSolid(x, y)) {
+				hx = x0 + dx * t;
+				hy = y0 + dy * t;
+				return true;
+			}
+
+			if ((x == xEnd && y == yEnd) || t > 1.0f)
+				return false;
+
+			if (tNextX < tNextY) {
+				t = tNextX;
+				tNextX += tDeltaX;
+				x += sx;
+				nx = (float)-sx;
+				ny = 0.0f;
+			}
+			else {
+				t = tNextY;
+				tNextY += tDeltaY;
+				y += sy;
+				nx = 0.0f;
+				ny = (float)-sy;
+			}
+		}
+	}
+
+	// Moving from x0, y0 to x1, y1, where the path first runs into land. On a hit hx, hy is
+	// a point just short of the land and nx, ny the surface normal there, from the field, or
+	// the side of the pixel where the field is flat. Paths already in land or heading out of
+	// it don't count
+	bool Sweep(float x0, float y0, float x1, float y1, float& hx, float& hy, float& nx, float& ny) const {
+		float fFaceX, fFaceY;
+		if (!RayMarch(x0, y0, x1, y1, hx, hy, fFaceX, fFaceY) || (fFaceX == 0.0f && fFaceY == 0.0f))
+			return false;
+
+		float dx = x1 - x0, dy = y1 - y0;
+		float fLength = sqrtf(dx * dx + dy * dy);
+		hx -= dx / fLength * 0.01f;
+		hy -= dy / fLength * 0.01f;
+
+		Distance(hx, hy, nx, ny);
+		if (nx == 0.0f && ny == 0.0f) {
+			nx = fFaceX;
+			ny = fFaceY;
+		}
+		return dx * nx + dy * ny < 0.0f;
+	}
+
+	// Share of land, 0..255, in the 2^nLevel pixel square of the pyramid holding x, y
+	uint8_t Coverage(int nLevel, int x, int y) const {
+		if (nLevel == 0)
+			return IsSolid(x, y) ? 255 : 0;
+		const sChunk* chunk = m_vecChunks[(y / CHUNK) * m_nChunksX + x / CHUNK];
+		int nSize = CHUNK >> nLevel;
+		return chunk->mips[MipOffset(nLevel) + ((y % CHUNK) >> nLevel) * nSize + ((x % CHUNK) >> nLevel)];
+	}
+
+	// Land from row vecTop[x] down in each column x. Chunks wholly above or below the
+	// surface are shared, so only the surface itself is built bit by bit
+	void SetColumns(const vector<int>& vecTop) {
+		for (int cy = 0; cy < m_nChunksY; cy++)
+			for (int cx = 0; cx < m_nChunksX; cx++) {
+				int x1 = cx * CHUNK, x2 = min(x1 + CHUNK, m_nWidth);
+				int y1 = cy * CHUNK;
+				auto range = minmax_element(vecTop.begin() + x1, vecTop.begin() + x2);
+
+				sChunk*& slot = m_vecChunks[cy * m_nChunksX + cx];
+				Release(slot);
+				if (y1 + CHUNK <= *range.first)
+					slot = Empty();
+				else if (y1 >= *range.second)
+					slot = Full();
+				else {
+					slot = Allocate();
+					for (int r = 0; r < CHUNK; r++) {
+						uint64_t bits = 0;
+						for (int x = x1; x < x2; x++)
+							if (y1 + r >= vecTop[x])
+								bits |= 1ull << (x - x1);
+						slot->rows[r] = bits;
+					}
+					BuildMips(slot);
+				}
+			}
+
+		for (int cy = 0; cy < m_nChunksY; cy++)
+			for (int cx = 0; cx < m_nChunksX; cx++)
+				BuildField(cx, cy);
+	}
+
+	// Calls fn(x1, x2, bSolid) for each run of land or sky along row y from x1 up to x2,
+	// skipping through a run a whole word at a time
+	template<typename F>
+	void Runs(int y, int x1, int x2, F fn) const {
+		int x = x1;
+		while (x < x2) {
+			bool bSolid = IsSolid(x, y);
+			uint64_t nFlip = bSolid ? ~0ull : 0ull;
+
+			// Set bits are where the run ends
+			int xWord = x & ~63;
+			uint64_t w = (Word(xWord >> 6, y) ^ nFlip) & (~0ull << (x & 63));
+			while (w == 0 && xWord + 64 < x2) {
+				xWord += 64;
+				w = Word(xWord >> 6, y) ^ nFlip;
+			}
+
+			int xEnd = w != 0 ? min(x2, xWord + CountTrailingZeros(w)) : x2;
+			fn(x, xEnd, bSolid);
+			x = xEnd;
+		}
+	}
+
+private:
+	// Levels 1 and up of the pyramid one after another, 32x32 then 16x16 and so on
+	static const int MIP_SIZE = 32 * 32 + 16 * 16 + 8 * 8 + 4 * 4 + 2 * 2 + 1;
+
+	static int MipOffset(int nLevel) {
+		static const int nOffsets[MIP_LEVELS] = { 0, 0, 1024, 1280, 1344, 1360, 1364 };
+		return nOffsets[nLevel];
+	}
+
+	struct sChunk {
+		uint64_t rows[CHUNK];
+		uint8_t mips[MIP_SIZE];
+		bool bDirty;
+	};
+
+	static sChunk* Empty() {
+		static sChunk chunk = {};
+		return &chunk;
+	}
+
+	static sChunk* Full() {
+		static sChunk chunk = [] {
+			sChunk c = {};
+			fill_n(c.rows, CHUNK, ~0ull);
+			fill_n(c.mips, MIP_SIZE, (uint8_t)255);
+			return c;
+		}();
+		return &chunk;
+	}
+
+	// Level 1 counts the 2x2 pixels under each texel, every level after averages 2x2 of
+	// the one before
+	static void BuildMips(sChunk* chunk) {
+		uint8_t* mip = chunk->mips;
+		for (int j = 0; j < CHUNK / 2; j++) {
+			uint64_t r0 = chunk->rows[j * 2], r1 = chunk->rows[j * 2 + 1];
+			for (int i = 0; i < CHUNK / 2; i++) {
+				int n = (int)((r0 >> (i * 2)) & 1) + (int)((r0 >> (i * 2 + 1)) & 1)
+					+ (int)((r1 >> (i * 2)) & 1) + (int)((r1 >> (i * 2 + 1)) & 1);
+				mip[j * (CHUNK / 2) + i] = (uint8_t)((n * 255 + 2) / 4);
+			}
+		}
+
+		for (int k = 2; k < MIP_LEVELS; k++) {
+			const uint8_t* src = chunk->mips + MipOffset(k - 1);
+			uint8_t* dst = chunk->mips + MipOffset(k);
+			int nSrc = CHUNK >> (k - 1), nDst = CHUNK >> k;
+			for (int j = 0; j < nDst; j++)
+				for (int i = 0; i < nDst; i++) {
+					const uint8_t* s = src + j * 2 * nSrc + i * 2;
+					dst[j * nDst + i] = (uint8_t)((s[0] + s[1] + s[nSrc] + s[nSrc + 1] + 2) / 4);
+				}
+		}
+		chunk->bDirty = false;
+	}
+
+	struct sField {
+		int8_t d[CHUNK * CHUNK];
+	};
+
+	// Squared distance along a line of n cells to the nearest cell where f is 0, the lower
+	// envelope of parabolas from Felzenszwalb and Huttenlocher
+	static void DistanceTransform(const float* f, int n, float* d, int* v, float* z) {
+		auto Intersect = [&](int q, int p) { return ((f[q] + q * q) - (f[p] + p * p)) / (2.0f * (q - p)); };
+
+		int k = 0;
+		v[0] = 0;
+		z[0] = -1e20f;
+		z[1] = 1e20f;
+		for (int q = 1; q < n; q++) {
+			float s = Intersect(q, v[k]);
+			while (s <= z[k]) {
+				k--;
+				s = Intersect(q, v[k]);
+			}
+			k++;
+			v[k] = q;
+			z[k] = s;
+			z[k + 1] = 1e20f;
+		}
+
+		k = 0;
+		for (int q = 0; q < n; q++) {
+			while (z[k + 1] < q)
+				k++;
+			d[q] = (q - v[k]) * (q - v[k]) + f[v[k]];
+		}
+	}
+
+	// Rebuilds the field tile of a chunk from the chunk and its apron. Where all of that is
+	// one kind there is no surface in range and no tile is needed
+	void BuildField(int cx, int cy) {
+		const int N = CHUNK + 2 * FIELD_APRON;
+		int x1 = cx * CHUNK - FIELD_APRON, y1 = cy * CHUNK - FIELD_APRON;
+		int bx1 = max(x1, 0), by1 = max(y1, 0);
+		int bx2 = min(x1 + N, m_nWidth), by2 = min(y1 + N, m_nHeight);
+
+		auto& tile = m_vecField[cy * m_nChunksX + cx];
+		if (!AnySolid(bx1, by1, bx2, by2) || AllSolid(bx1, by1, bx2, by2)) {
+			tile.reset();
+			return;
+		}
+		if (!tile)
+			tile.reset(new sField);
+
+		// Squared distance to the nearest land pixel and to the nearest sky pixel, off the
+		// map edges carrying on as the edge pixels do. None in reach is just very far
+		const float fFar = 1e6f;
+		static thread_local vector<float> vecLand, vecSky, vecCol, vecOut, vecZ;
+		static thread_local vector<int> vecV;
+		vecLand.resize(N * N); vecSky.resize(N * N);
+		vecCol.resize(N); vecOut.resize(N); vecZ.resize(N + 1); vecV.resize(N);
+		for (int j = 0; j < N; j++)
+			for (int i = 0; i < N; i++) {
+				bool bSolid = IsSolid(max(0, min(x1 + i, m_nWidth - 1)), max(0, min(y1 + j, m_nHeight - 1)));
+				vecLand[j * N + i] = bSolid ? 0.0f : fFar;
+				vecSky[j * N + i] = bSolid ? fFar : 0.0f;
+			}
+
+		for (vector<float>* grid : { &vecLand, &vecSky }) {
+			float* g = grid->data();
+			for (int i = 0; i < N; i++) {
+				for (int j = 0; j < N; j++)
+					vecCol[j] = g[j * N + i];
+				DistanceTransform(vecCol.data(), N, vecOut.data(), vecV.data(), vecZ.data());
+				for (int j = 0; j < N; j++)
+					g[j * N + i] = vecOut[j];
+			}
+			for (int j = 0; j < N; j++) {
+				DistanceTransform(g + j * N, N, vecOut.data(), vecV.data(), vecZ.data());
+				copy(vecOut.begin(), vecOut.end(), g + j * N);
+			}
+		}
+
+		// The surface runs half a pixel out from the middle of the pixels either side of it
+		for (int j = 0; j < CHUNK; j++)
+			for (int i = 0; i < CHUNK; i++) {
+				int n = (j + FIELD_APRON) * N + i + FIELD_APRON;
+				float d = vecLand[n] > 0.0f ? sqrtf(vecLand[n]) - 0.5f : 0.5f - sqrtf(vecSky[n]);
+				tile->d[j * CHUNK + i] = (int8_t)max(-127.0f, min(127.0f, roundf(d * FIELD_SCALE)));
+			}
+	}
+
+	static bool IsShared(const sChunk* chunk) {
+		return chunk == Empty() || chunk == Full();
+	}
+
+	sChunk* Allocate() {
+		m_nAllocated++;
+		return new sChunk;
+	}
+
+	void Release(sChunk*& chunk) {
+		if (!IsShared(chunk)) {
+			delete chunk;
+			m_nAllocated--;
+		}
+		chunk = Empty();
+	}
+
+	// The chunk holding word w of row y, copied out of the shared one if need be
+	sChunk* Writable(int w, int y) {
+		sChunk*& slot = m_vecChunks[(y / CHUNK) * m_nChunksX + w];
+		if (IsShared(slot)) {
+			sChunk* chunk = Allocate();
+			*chunk = *slot;
+			chunk->bDirty = false;
+			slot = chunk;
+		}
+		return slot;
+	}
+
+	// Only ever called after clearing, so the chunk can have become all sky but not all land.
+	// Bits hanging off the right or bottom edge of the map don't count
+	void ShareIfUniform(int w, int y) {
+		sChunk*& slot = m_vecChunks[(y / CHUNK) * m_nChunksX + w];
+		int nRows = min(CHUNK, m_nHeight - (y / CHUNK) * CHUNK);
+		uint64_t mask = SpanMask(w, w * 64, min(w * 64 + 64, m_nWidth));
+		for (int r = 0; r < nRows; r++)
+			if (slot->rows[r] & mask)
+				return;
+		Release(slot);
+	}
+
+	void Free() {
+		for (auto& chunk : m_vecChunks)
+			Release(chunk);
+		m_vecChunks.clear();
+		m_vecField.clear();
+		m_vecDirty.clear();
+	}
+
+private:
+	int m_nWidth = 0;
+	int m_nHeight = 0;
+	int m_nChunksX = 0;
+	int m_nChunksY = 0;
+	int m_nAllocated = 0;
+	vector<sChunk*> m_vecChunks;
+	vector<unique_ptr<sField>> m_vecField;
+	vector<int> m_vecDirty;
+};
+
+// The terrain as it looks on screen, baked into CHAR_INFO cells so drawing it is a copy
+// rather than a choice per cell. Only chunks of the terrain with some surface in them are
+// baked, chunks that are all sky or all land are drawn as plain spans of their cell
+class cTerrainLayer {
+public:
+	// Bakes all of the terrain, with one cell for land and one for the sky on each row
+	void Create(const cTerrain& terrain, CHAR_INFO land, const vector<CHAR_INFO>& vecSky) {
+		m_pTerrain = &terrain;
+		m_land = land;
+		m_vecSky = vecSky;
+		m_vecBaked.clear();
+		m_vecBaked.resize(terrain.ChunksX() * terrain.ChunksY());
+		Update(0, 0, terrain.Width(), terrain.Height());
+	}
+
+	// Rebakes the box x1 up to x2, y1 up to y2 after the terrain in it has changed
+	void Update(int x1, int y1, int x2, int y2) {
+		const int CHUNK = cTerrain::CHUNK;
+		x1 = max(x1, 0);
+		y1 = max(y1, 0);
+		x2 = min(x2, m_pTerrain->Width());
+		y2 = min(y2, m_pTerrain->Height());
+		if (x1 >= x2 || y1 >= y2)
+			return;
+
+		for (int cy = y1 / CHUNK; cy <= (y2 - 1) / CHUNK; cy++)
+			for (int cx = x1 / CHUNK; cx <= (x2 - 1) / CHUNK; cx++) {
+				auto& baked = m_vecBaked[cy * m_pTerrain->ChunksX() + cx];
+				bool bSolid;
+				if (m_pTerrain->IsUniform(cx, cy, bSolid)) {
+					baked.reset();
+					continue;
+				}
+
+				// A chunk baked for the first time is done whole
+				int bx1 = cx * CHUNK, by1 = cy * CHUNK;
+				int bx2 = min(bx1 + CHUNK, m_pTerrain->Width()), by2 = min(by1 + CHUNK, m_pTerrain->Height());
+				if (baked) {
+					bx1 = max(bx1, x1); by1 = max(by1, y1);
+					bx2 = min(bx2, x2); by2 = min(by2, y2);
+				}
+				else
+					baked.reset(new sBaked);
+
+				for (int y = by1; y < by2; y++) {
+					CHAR_INFO* row = &baked->cells[(y % CHUNK) * CHUNK];
+					m_pTerrain->Runs(y, bx1, bx2, [&](int rx1, int rx2, bool bSolid) {
+						fill_n(row + rx1 % CHUNK, rx2 - rx1, bSolid ? m_land : m_vecSky[y]);
+					});
+				}
+			}
+	}
+
+	// Draws terrain row y from x up to x + n, to the screen at nScreenX, nScreenY
+	void DrawRow(ConsoleTemplateEngine* engine, int x, int y, int n, int nScreenX, int nScreenY) const {
+		const int CHUNK = cTerrain::CHUNK;
+		int x1 = x;
+		int x2 = min(x + n, m_pTerrain->Width());
+		while (x < x2) {
+			int cx = x / CHUNK, cy = y / CHUNK;
+			int xEnd = min(x2, (cx + 1) * CHUNK);
+			int sx = nScreenX + x - x1;
+
+			auto& baked = m_vecBaked[cy * m_pTerrain->ChunksX() + cx];
+			if (baked)
+				engine->DrawSpan(sx, nScreenY, &baked->cells[(y % CHUNK) * CHUNK + x % CHUNK], xEnd - x);
+			else {
+				bool bSolid;
+				m_pTerrain->IsUniform(cx, cy, bSolid);
+				CHAR_INFO c = bSolid ? m_land : m_vecSky[y];
+				engine->DrawSpan(sx, sx + xEnd - x, nScreenY, c.Char.UnicodeChar, c.Attributes);
+			}
+			x = xEnd;
+		}
+	}
+
+	// Draws a screen row of terrain row y at any zoom, stepping across the terrain from u in
+	// 16.16 fixed point steps of du. Land coverage comes from pyramid level nLevel and partly
+	// covered cells are shaded, so that thin features blend in rather than flicker. A view
+	// larger than the map shows sky beyond its edges, in the colour of the nearest row
+	void DrawRowScaled(ConsoleTemplateEngine* engine, int u, int du, int y, int nLevel, int nScreenY, int nScreenWidth) const {
+		int nSkyRow = max(0, min(y, m_pTerrain->Height() - 1));
+		if (y != nSkyRow) {
+			CHAR_INFO c = m_vecSky[nSkyRow];
+			engine->DrawSpan(0, nScreenWidth, nScreenY, c.Char.UnicodeChar, c.Attributes);
+			return;
+		}
+
+		// Land over this row's sky in quarters, sky cells that are shaded themselves lend
+		// their background, plain ones their colour
+		CHAR_INFO cells[5] = { m_vecSky[y], m_land, m_land, m_land, m_land };
+		short nSkyAttr = m_vecSky[y].Attributes;
+		short nBack = (nSkyAttr & 0xF0) ? (nSkyAttr & 0xF0) : (short)((nSkyAttr & 0x0F) << 4);
+		const wchar_t glyphs[3] = { PIXEL_QUARTER, PIXEL_HALF, PIXEL_THREEQUARTERS };
+		for (int i = 0; i < 3; i++) {
+			cells[i + 1].Char.UnicodeChar = glyphs[i];
+			cells[i + 1].Attributes = (m_land.Attributes & 0x0F) | nBack;
+		}
+
+		auto Sample = [&](int x) {
+			int64_t wx = ((int64_t)u + (int64_t)x * du) >> 16;
+			if (wx < 0 || wx >= m_pTerrain->Width())
+				return 0;
+			return (m_pTerrain->Coverage(nLevel, (int)wx, y) * 4 + 127) / 255;
+		};
+
+		int x = 0;
+		while (x < nScreenWidth) {
+			int q = Sample(x);
+			int xEnd = x + 1;
+			while (xEnd < nScreenWidth && Sample(xEnd) == q)
+				xEnd++;
+			engine->DrawSpan(x, xEnd, nScreenY, cells[q].Char.UnicodeChar, cells[q].Attributes);
+			x = xEnd;
+		}
+	}
+
+private:
+	struct sBaked {
+		CHAR_INFO cells[cTerrain::CHUNK * cTerrain::CHUNK];
+	};
+
+	const cTerrain* m_pTerrain = nullptr;
+	CHAR_INFO m_land;
+	vector<CHAR_INFO> m_vecSky;
+	vector<unique_ptr<sBaked>> m_vecBaked;
+};
+
+// Debris thrown out by explosions. There can be a great many, so rather than objects they
+// are particles held as parallel arrays, moved in straight loops over the arrays and
+// removed by swapping the last one into their place
+class cDebrisSystem {
+public:
+	cDebrisSystem() {
+		// Random directions are looked up rather than computed
+		for (int i = 0; i < DIRECTIONS; i++) {
+			m_fCos[i] = cosf(i * 2.0f * 3.14159f / DIRECTIONS);
+			m_fSin[i] = sinf(i * 2.0f * 3.14159f / DIRECTIONS);
+		}
+	}
+
+	int Count() const {
+		return (int)px.size();
+	}
+
+	// Kept count of moving pieces, so this needs no pass over them
+	bool AllStable() const {
+		return m_nUnstable == 0;
+	}
+
+	void Wake(int i) {
+		if (stable[i]) {
+			stable[i] = 0;
+			m_nUnstable++;
+		}
+	}
+
+	// Launches n pieces from x, y in random directions
+	void Spawn(float x, float y, int n) {
+		for (int i = 0; i < n; i++) {
+			px.push_back(x);
+			py.push_back(y);
+			lx.push_back(x);
+			ly.push_back(y);
+			vx.push_back(10.0f * m_fCos[Random() % DIRECTIONS]);
+			vy.push_back(10.0f * m_fSin[Random() % DIRECTIONS]);
+			bounces.push_back(2); // After 2 bounces, dispose
+			stable.push_back(0);
+		}
+		m_nUnstable += n;
+	}
+
+	// Every piece is a little ball, with the same terrain bounce as the objects
+	static constexpr float RADIUS = 1.0f;
+	static constexpr float FRICTION = 0.8f;
+
+	// One physics step, the same as for objects with a radius of 1 and friction of 0.8. It
+	// goes BeginStep(), then Step() over every piece, in as many ranges as liked and from
+	// any threads, then EndStep() to clear away the pieces that are done
+	void BeginStep() {
+		int n = Count();
+		lx = px;
+		ly = py;
+		m_tx.resize(n);
+		m_ty.resize(n);
+		m_dead.assign(n, 0);
+	}
+
+	void Step(float fElapsedTime, const cTerrain& terrain, int i1, int i2) {
+		// Gravity and the move each piece would like to make
+		float* __restrict x = px.data();
+		float* __restrict y = py.data();
+		float* __restrict dx = vx.data();
+		float* __restrict dy = vy.data();
+		float* __restrict tx = m_tx.data();
+		float* __restrict ty = m_ty.data();
+		for (int i = i1; i < i2; i++) {
+			dy[i] += 2.0f * fElapsedTime;
+			tx[i] = x[i] + dx[i] * fElapsedTime;
+			ty[i] = y[i] + dy[i] * fElapsedTime;
+		}
+
+		// Collisions, and bounce or move
+		const float fRadius = RADIUS, fFriction = FRICTION;
+		for (int i = i1; i < i2; i++) {
+			float fMagVelocity = sqrtf(dx[i] * dx[i] + dy[i] * dy[i]);
+			if (x[i] < 0 || x[i] > terrain.Width() || y[i] < 0 || y[i] > terrain.Height())
+				m_dead[i] = 1;
+
+			float nx, ny;
+			float fDistance = terrain.Distance(tx[i], ty[i], nx, ny);
+			if (nx == 0.0f && ny == 0.0f && fDistance < 0.0f) {
+				nx = fMagVelocity > 0.0f ? -dx[i] / fMagVelocity : 0.0f;
+				ny = fMagVelocity > 0.0f ? -dy[i] / fMagVelocity : -1.0f;
+			}
+
+			// Traced like fast objects, for pieces moving further than their size
+			bool bHit = fDistance < fRadius && dx[i] * nx + dy[i] * ny < 0.0f;
+			float mx = tx[i] - x[i], my = ty[i] - y[i];
+			if (!bHit && mx * mx + my * my > fRadius * fRadius) {
+				float hx, hy;
+				if (terrain.Sweep(x[i], y[i], tx[i], ty[i], hx, hy, nx, ny)) {
+					bHit = true;
+					x[i] = hx;
+					y[i] = hy;
+				}
+			}
+
+			stable[i] = 0;
+			if (bHit) {
+				stable[i] = 1;
+				float dot = dx[i] * nx + dy[i] * ny;
+				dx[i] = fFriction * (-2.0f * dot * nx + dx[i]);
+				dy[i] = fFriction * (-2.0f * dot * ny + dy[i]);
+				if (--bounces[i] == 0)
+					m_dead[i] = 1;
+			}
+			else {
+				x[i] = tx[i];
+				y[i] = ty[i];
+			}
+
+			if (fMagVelocity < 0.1f)
+				stable[i] = 1;
+		}
+	}
+
+	void EndStep() {
+		// Swap remove the dead, counting the moving pieces that are left on the way
+		int n = Count();
+		m_nUnstable = 0;
+		for (int i = 0; i < n;) {
+			if (m_dead[i]) {
+				n--;
+				px[i] = px[n]; py[i] = py[n]; lx[i] = lx[n]; ly[i] = ly[n]; vx[i] = vx[n]; vy[i] = vy[n];
+				bounces[i] = bounces[n]; stable[i] = stable[n]; m_dead[i] = m_dead[n];
+			}
+			else {
+				m_nUnstable += stable[i] == 0;
+				i++;
+			}
+		}
+		px.resize(n); py.resize(n); lx.resize(n); ly.resize(n); vx.resize(n); vy.resize(n);
+		bounces.resize(n); stable.resize(n);
+	}
+
+	// Screen row of piece i, for a camera at fCameraY with fZoom world pixels per screen cell,
+	// fAlpha of the way through the last step
+	float ScreenY(int i, float fCameraY, float fZoom, float fAlpha) const {
+		return (ly[i] + (py[i] - ly[i]) * fAlpha - fCameraY) / fZoom;
+	}
+
+	// Draws piece i for a camera at fCameraX, fCameraY with fZoom world pixels per screen
+	// cell, fAlpha of the way through the last step. It reaches no more than 2 rows either
+	// side of ScreenY(), zoomed out it's a single cell
+	void Draw(ConsoleTemplateEngine* engine, int i, float fCameraX, float fCameraY, float fZoom, float fAlpha) const {
+		float sx = (lx[i] + (px[i] - lx[i]) * fAlpha - fCameraX) / fZoom;
+		float sy = ScreenY(i, fCameraY, fZoom, fAlpha);
+		if (fZoom >= 2.0f)
+			engine->Draw((int)sx, (int)sy, PIXEL_SOLID, FG_DARK_GREEN);
+		else
+			engine->DrawWireFrameModel(m_vecModel, sx, sy, atan2f(vy[i], vx[i]), 1.0f, FG_DARK_GREEN);
+	}
+
+public:
+	vector<float> px, py;			// Position
+	vector<float> lx, ly;			// Position before the last step
+	vector<float> vx, vy;			// Velocity
+	vector<uint8_t> bounces;		// Bounces left before disposal
+	vector<uint8_t> stable;			// Has stopped moving
+
+private:
+	static const int DIRECTIONS = 1024;
+
+	// Xorshift, the game's rand() is left to everything else
+	uint32_t Random() {
+		m_nRandom ^= m_nRandom << 13;
+		m_nRandom ^= m_nRandom >> 17;
+		m_nRandom ^= m_nRandom << 5;
+		return m_nRandom;
+	}
+
+	uint32_t m_nRandom = 2463534242u;
+	int m_nUnstable = 0;
+	float m_fCos[DIRECTIONS];
+	float m_fSin[DIRECTIONS];
+	vector<float> m_tx, m_ty;
+	vector<uint8_t> m_dead;
+	const vector<pair<float, float>> m_vecModel = DefineDebris();
+};
+
+// Uniform grid for finding what is near what. Items go in the cell their centre is in, cells
+// are hashed into a fixed number of buckets so the world can be any size, and a counting sort
+// lays each bucket's items out together. Building is linear in the number of items, and a
+// query only looks at the buckets of the cells it covers
+class cSpatialHash {
+public:
+	cSpatialHash(float fCellSize = 8.0f) {
+		m_fInvCell = 1.0f / fCellSize;
+	}
+
+	void Clear() {
+		m_vecItems.clear();
+	}
+
+	void Add(int nId, float x, float y) {
+		m_vecItems.push_back({ Cell(x), Cell(y), nId });
+	}
+
+	// Sort the added items into their buckets, ready for queries
+	void Build() {
+		m_vecStart.assign(BUCKETS + 1, 0);
+		for (auto& it : m_vecItems)
+			m_vecStart[Bucket(it.cx, it.cy) + 1]++;
+		for (int b = 0; b < BUCKETS; b++)
+			m_vecStart[b + 1] += m_vecStart[b];
+
+		m_vecFill.assign(m_vecStart.begin(), m_vecStart.end() - 1);
+		m_vecSorted.resize(m_vecItems.size());
+		for (auto& it : m_vecItems)
+			m_vecSorted[m_vecFill[Bucket(it.cx, it.cy)]++] = it;
+	}
+
+	// Calls fn(nId) once for every item centred in a cell the square of half width r around
+	// x, y touches. Callers do their own exact test
+	template<class F>
+	void Query(float x, float y, float r, F fn) const {
+		int cx1 = Cell(x - r), cx2 = Cell(x + r);
+		int cy1 = Cell(y - r), cy2 = Cell(y + r);
+		for (int cy = cy1; cy <= cy2; cy++)
+			for (int cx = cx1; cx <= cx2; cx++) {
+				int b = Bucket(cx, cy);
+				for (int k = m_vecStart[b]; k < m_vecStart[b + 1]; k++) {
+					// Other cells can share the bucket
+					const sItem& it = m_vecSorted[k];
+					if (it.cx == cx && it.cy == cy)
+						fn(it.nId);
+				}
+			}
+	}
+
+private:
+	static const int BUCKETS = 4096;
+
+	struct sItem {
+		int cx, cy;
+		int nId;
+	};
+
+	int Cell(float v) const {
+		return (int)floorf(v * m_fInvCell);
+	}
+
+	static int Bucket(int cx, int cy) {
+		return (int)(((uint32_t)cx * 73856093u ^ (uint32_t)cy * 19349663u) & (BUCKETS - 1));
+	}
+
+	float m_fInvCell;
+	vector<sItem> m_vecItems;
+	vector<sItem> m_vecSorted;
+	vector<int> m_vecStart;
+	vector<int> m_vecFill;
+};
+
 class WormGun : public ConsoleTemplateEngine {
 public:
 	WormGun() {
 		m_sAppName = L"Wormlike Game";
 	}
 
+	// Terrain size, must be called before Start()
+	void SetMapSize(int nWidth, int nHeight) {
+		nMapWidth = nWidth;
+		nMapHeight = nHeight;
+	}
+
+	// Physics ticks per real second. Game speed stays the same, only the step size changes
+	void SetPhysicsTickRate(int nTicksPerSecond) {
+		nPhysicsTickRate = max(1, nTicksPerSecond);
+	}
+
 private:
 	// Terrain size
 	int nMapWidth = 1024;
 	int nMapHeight = 512;
-	char* map = nullptr;
+
+	// Sky isn't stored, it's shaded by altitude
+	cTerrain terrain;
+	cTerrainLayer terrainLayer;
 
 	// Camera Coordinates
 	float fCameraPosX = 0.0f;
@@ -259,14 +1165,85 @@ private:
 	float fCameraPosXTarget = 0.0f;
 	float fCameraPosYTarget = 0.0f;
 
-	// list of things that exist in game world
-	list<unique_ptr<cPhysicsObject>> listObjects;
+	// Things that exist in game world, one pool per type. Everything else refers to them by
+	// handle, so a worm or missile that has gone resolves to nullptr rather than freed memory
+	SlotMap<cWorm> worms;
+	SlotMap<cMissile> missiles;
+	cDebrisSystem debris;
+
+	// Physics advances in fixed ticks, so a game plays out the same whatever the frame rate.
+	// Game time runs 10 times faster than real time, the pace the game was tuned at
+	int nPhysicsTickRate = 60;				// Ticks per real second, fast objects take extra steps of their own
+	int nMaxSubsteps = 16;					// Most steps one object may split a tick into
+	int nMaxPhysicsTicks = 60;				// Most ticks one frame may run, any backlog beyond is dropped
+	float fPhysicsTimeScale = 10.0f;		// Game seconds per real second
+	float fPhysicsAccumulator = 0.0f;		// Ticks owed, the fraction carries to the next frame
+	float fPhysicsAlpha = 0.0f;				// How far drawing is from the previous tick to the latest
+
+	// Objects stable for long enough fall asleep and are left out of the physics. Blasts, contacts
+	// and jumps wake them. Kept count of those awake, the game is stable when there are none
+	float fSleepTime = 1.25f;				// Game seconds at rest before an object sleeps
+	float fSleepSpeed = 0.25f;				// Any faster and it isn't at rest, stable or not
+	int nAwakeObjects = 0;
+
+	SlotHandle hObjectUnderControl;		// Worm currently under control
+	SlotHandle hCameraWorm;				// Camera tracks this worm, or the missile below, whichever is set
+	SlotHandle hCameraMissile;
+
+	cWorm* ControlledWorm() {
+		return worms.Get(hObjectUnderControl);
+	}
+
+	cPhysicsObject* CameraTarget() {
+		if (cMissile* m = missiles.Get(hCameraMissile))
+			return m;
+		return worms.Get(hCameraWorm);
+	}
 
-	cPhysicsObject* pObjectUnderControl = nullptr;		// Pointer to object currently under control
-	cPhysicsObject* pCameraTrackingObject = nullptr;	// Pointer to object that camera should track
+	void TrackWorm(SlotHandle h) {
+		hCameraWorm = h;
+		hCameraMissile = SlotHandle();
+	}
+
+	void TrackMissile(SlotHandle h) {
+		hCameraMissile = h;
+		hCameraWorm = SlotHandle();
+	}
+
+	// Visit every worm then every missile as a plain physics object
+	template<class F>
+	void ForEachObject(F fn) {
+		for (auto& w : worms)
+			fn((cPhysicsObject&)w);
+		for (auto& m : missiles)
+			fn((cPhysicsObject&)m);
+	}
+
+	// A worm or a missile by handle, for finding an object again later
+	struct sObjectRef {
+		bool bMissile;
+		SlotHandle h;
+	};
+
+	cPhysicsObject* Resolve(sObjectRef ref) {
+		if (ref.bMissile)
+			return missiles.Get(ref.h);
+		return worms.Get(ref.h);
+	}
+
+	// As ForEachObject(), with a reference to each object that outlives the visit
+	template<class F>
+	void ForEachObjectRef(F fn) {
+		for (size_t i = 0; i < worms.Size(); i++)
+			fn((cPhysicsObject&)worms[i], sObjectRef{ false, worms.HandleAt(i) });
+		for (size_t i = 0; i < missiles.Size(); i++)
+			fn((cPhysicsObject&)missiles[i], sObjectRef{ true, missiles.HandleAt(i) });
+	}
 
 	// Flags that govern/are set by game state machine
 	bool bZoomOut = false;					// Render whole map
+	float fZoom = 1.0f;						// World pixels per screen cell, eases toward the whole map or fZoomNear
+	float fZoomNear = 1.0f;					// Zoom when not showing the whole map, mouse wheel and PgUp/PgDn change it
 	bool bGameIsStable = false;				// All physics objects are stable
 	bool bEnablePlayerControl = true;		// The player is in control, keyboard input enabled
 	bool bEnableComputerControl = false;	// The AI is in control
@@ -294,10 +1271,128 @@ private:
 	float fAITargetAngle = 0.0f;		// Angle AI should aim for
 	float fAITargetEnergy = 0.0f;		// Energy level AI should aim for
 	float fAISafePosition = 0.0f;		// X-Coordinate considered safe for AI to move to
-	cWorm* pAITargetWorm = nullptr;		// Pointer to worm AI has selected as target
+	SlotHandle hAITargetWorm;			// Worm AI has selected as target
 	float fAITargetX = 0.0f;			// Coordinates of target missile location
 	float fAITargetY = 0.0f;
 
+	// Shot planner, see PlanShot()
+	struct sShot {
+		float fAngle;
+		float fEnergy;
+		float fScore;
+	};
+	struct sShotTarget {
+		float x, y, radius;
+		float fHealth;
+		bool bEnemy;
+		bool bShooter;
+	};
+	int nPlanCandidates = 64;			// Shots tried per plan
+	int nPlanSamples = 4;				// Times each is flown, with a little jitter
+	float fPlanFlightTime = 20.0f;		// Game seconds a tried shot may stay in the air
+	float fPlanBudget = 0.25f;			// Real seconds before untried shots are skipped, only a safety net
+	vector<sShotTarget> vecPlanTargets;
+	vector<sShot> vecPlanShots;
+	sShot planned = { 0.0f, 0.0f, 0.0f };	// Last plan, good while the shooter and terrain stay put
+	bool bPlanned = false;
+	float fPlannedX = 0.0f;
+	float fPlannedY = 0.0f;
+	int nPlannedBlasts = 0;
+	int nBlastsApplied = 0;				// Explosions so far, each one changes the terrain
+
+	// Profiler phases and counters, F3 shows them
+	int nPhaseControl = -1;
+	int nPhasePhysics = -1;
+	int nPhaseBoom = -1;
+	int nPhasePlan = -1;
+	int nPhaseTerrain = -1;
+	int nPhaseObjects = -1;
+	int nCounterObjects = -1;
+	int nCounterDebris = -1;
+	int nCounterSamples = -1;
+	int nCounterChunks = -1;
+	int nCounterTicks = -1;
+	int nCounterContacts = -1;
+
+	// Changes to the world are never made while objects are being stepped. They are recorded
+	// as commands, each kind in an array of its own, and carried out together between ticks
+	// by ExecuteCommands() in the order they were recorded
+	struct sSpawn {
+		float x, y, vx, vy;
+		bool bTrack;			// Camera follows the new missile
+	};
+	struct sBlast {
+		float x, y, radius;
+	};
+	struct sDamage {
+		sObjectRef obj;
+		float fAmount;
+	};
+	struct sCommandBuffer {
+		vector<sSpawn> vecSpawn;		// New missiles
+		vector<sBlast> vecExplode;		// Craters, shockwave and debris
+		vector<sDamage> vecDamage;
+		vector<sObjectRef> vecKill;		// Objects to remove from their pools
+		int nSamples = 0;				// Terrain distance lookups, for the profiler
+
+		void Append(const sCommandBuffer& b) {
+			vecSpawn.insert(vecSpawn.end(), b.vecSpawn.begin(), b.vecSpawn.end());
+			vecExplode.insert(vecExplode.end(), b.vecExplode.begin(), b.vecExplode.end());
+			vecDamage.insert(vecDamage.end(), b.vecDamage.begin(), b.vecDamage.end());
+			vecKill.insert(vecKill.end(), b.vecKill.begin(), b.vecKill.end());
+			nSamples += b.nSamples;
+		}
+
+		void Clear() {
+			vecSpawn.clear();
+			vecExplode.clear();
+			vecDamage.clear();
+			vecKill.clear();
+			nSamples = 0;
+		}
+	};
+	sCommandBuffer commands;
+	vector<vector<int>> vecCraterSpans;		// Crater shapes by radius
+
+	// Objects for the current physics tick, and the commands each parallel range of them
+	// recorded, joined onto the main buffer in range order
+	struct sStepObject {
+		cPhysicsObject* p;
+		sObjectRef ref;
+	};
+	vector<sStepObject> vecStepObjects;
+	vector<sCommandBuffer> vecStepCommands;
+
+	// Worms, missiles and debris alike as circles, objects first, indexed by the spatial hash
+	// for blasts and contacts. The pointers are good until anything is spawned or removed
+	struct sBody {
+		float* px;
+		float* py;
+		float* vx;
+		float* vy;
+		float r;
+		float fFriction;
+		cPhysicsObject* pObject;	// Null for debris
+		int nDebris;				// Index into the debris, for debris
+		sObjectRef ref;
+	};
+	struct sContact {
+		int a, b;
+	};
+	vector<sBody> vecBodies;
+	float fMaxBodyRadius = 0.0f;
+	cSpatialHash bodyHash;
+	vector<vector<sContact>> vecRangeContacts;
+
+	// Per band draw timings, collected in parallel and summed into the phases afterwards
+	vector<float> vecBandTerrainTime;
+	vector<float> vecBandObjectsTime;
+
+	// Objects and debris to draw this frame, binned by the screen bands they reach
+	vector<cPhysicsObject*> vecDrawObjects;
+	BandBins objectBins;
+	BandBins debrisBins;
+
 	// Game States
 	enum GAME_STATE {
 		GS_RESET = 0,
@@ -322,8 +1417,8 @@ private:
 
 	virtual bool OnUserCreate() {
 		// Create Map
-		map = new char[nMapWidth * nMapHeight];
-		memset(map, 0, nMapWidth * nMapHeight * sizeof(char));
+		terrain.Create(nMapWidth, nMapHeight);
+		BakeTerrain();
 		//CreateMap();
 
 		// Set initial states for state machines
@@ -334,34 +1429,40 @@ private:
 
 		bGameIsStable = false;
 
+		nPhaseControl = m_profiler.AddPhase(L"Control");
+		nPhasePhysics = m_profiler.AddPhase(L"Physics");
+		nPhaseBoom = m_profiler.AddPhase(L"Boom");
+		nPhasePlan = m_profiler.AddPhase(L"Plan");
+		nPhaseTerrain = m_profiler.AddPhase(L"Terrain");
+		nPhaseObjects = m_profiler.AddPhase(L"Objects");
+		nCounterObjects = m_profiler.AddCounter(L"Objects");
+		nCounterDebris = m_profiler.AddCounter(L"Debris");
+		nCounterSamples = m_profiler.AddCounter(L"Samples");
+		nCounterChunks = m_profiler.AddCounter(L"Chunks");
+		nCounterTicks = m_profiler.AddCounter(L"Ticks");
+		nCounterContacts = m_profiler.AddCounter(L"Contacts");
+
 		return true;
 	}
 
 	virtual bool OnUserUpdate(float fElapsedTime) {
-		// USER INPUT FOR TESTING OBJECTS
-		/*if (m_keys[L'M'].bReleased)
-			CreateMap();
-		if (m_mouse[0].bReleased)
-			Boom(m_mousePosX + fCameraPosX, m_mousePosY + fCameraPosY, 10.0f);
-		if (m_mouse[1].bReleased)
-			listObjects.push_back(unique_ptr<cMissile>(new cMissile(m_mousePosX + fCameraPosX, m_mousePosY + fCameraPosY)));
-		if (m_mouse[2].bReleased) {
-			cWorm* worm = new cWorm(m_mousePosX + fCameraPosX, m_mousePosY + fCameraPosY);
-			pObjectUnderControl = worm;
-			pCameraTrackingObject = worm;
-			listObjects.push_back(unique_ptr<cWorm>(worm));
-		}
-			//listObjects.push_back(unique_ptr<cWorm>(new cWorm(m_mousePosX + fCameraPosX, m_mousePosY + fCameraPosY)));
-			//cDummy* p = new cDummy(m_mousePosX + fCameraPosX, m_mousePosY + fCameraPosY);
-			//listObjects.push_back(unique_ptr<cDummy>(p));
-		*/
+		auto tpControl = chrono::steady_clock::now();
+		float fPlanTimeBefore = m_profiler.FrameTime(nPhasePlan);	// The AI plans within control, see below
+
 		// Camera Contorl
 		// Tab key toggles between whole map view and up close view
 		if (m_keys[VK_TAB].bReleased)
 			bZoomOut = !bZoomOut;
 
+		// Mouse wheel and PgUp/PgDn zoom the up close view in and out
+		int nZoomSteps = m_nMouseWheel + (m_keys[VK_PRIOR].bPressed ? 1 : 0) - (m_keys[VK_NEXT].bPressed ? 1 : 0);
+		if (nZoomSteps != 0) {
+			fZoomNear = max(1.0f, min(fZoomNear * powf(0.8f, (float)nZoomSteps), ZoomWholeMap()));
+			bZoomOut = false;
+		}
+
 		// Mouse Edge Map Scroll // Issues with corner movement causing wireframe functiont to crash
-		float fMapScrollSpeed = 400.0f;
+		float fMapScrollSpeed = 400.0f * fZoom;
 		if (m_mousePosX < 5)
 			fCameraPosX -= fMapScrollSpeed * fElapsedTime;
 		if (m_mousePosX > ScreenWidth() - 5)
@@ -416,18 +1517,18 @@ private:
 						float fWormY = 0.0f;
 
 						// Add worms to teams
-						cWorm* worm = new cWorm(fWormX, fWormY);
-						worm->nTeam = t;
-						listObjects.push_back(unique_ptr<cWorm>(worm));
-						vecTeams[t].vecMembers.push_back(worm);
+						SlotHandle h = worms.Emplace(fWormX, fWormY);
+						worms.Get(h)->nTeam = t;
+						nAwakeObjects++;
+						vecTeams[t].vecMembers.push_back(h);
 						vecTeams[t].nTeamSize = nWormsPerTeam;
 					}
 
 					vecTeams[t].nCurrentMember = 0;
 				}
 				// Select players first worm for control and camera tracking
-				pObjectUnderControl = vecTeams[0].vecMembers[vecTeams[0].nCurrentMember];
-				pCameraTrackingObject = pObjectUnderControl;
+				hObjectUnderControl = vecTeams[0].vecMembers[vecTeams[0].nCurrentMember];
+				TrackWorm(hObjectUnderControl);
 				bShowCountDown = false;
 				nNextState = GS_ALLOCATING_UNITS;
 			}
@@ -466,7 +1567,7 @@ private:
 					do {
 						nCurrentTeam++;
 						nCurrentTeam %= vecTeams.size();
-					} while (!vecTeams[nCurrentTeam].IsTeamAlive());
+					} while (!vecTeams[nCurrentTeam].IsTeamAlive(worms));
 
 					//Lock controls if AI team is currently playing
 					if (nCurrentTeam == 0) { // Player Team
@@ -479,8 +1580,8 @@ private:
 					}
 
 					// Set control and camera
-					pObjectUnderControl = vecTeams[nCurrentTeam].GetNextMember();
-					pCameraTrackingObject = pObjectUnderControl;
+					hObjectUnderControl = vecTeams[nCurrentTeam].GetNextMember(worms);
+					TrackWorm(hObjectUnderControl);
 					fTurnTime = 15.0f;
 					bZoomOut = false;
 					nNextState = GS_START_PLAY;
@@ -504,7 +1605,7 @@ private:
 				{
 					int nBombX = rand() % nMapWidth;
 					int nBombY = rand() % (nMapHeight / 2);
-					listObjects.push_back(unique_ptr<cMissile>(new cMissile(nBombX, nBombY, 0.0f, 0.5f)));
+					commands.vecSpawn.push_back({ (float)nBombX, (float)nBombY, 0.0f, 0.5f, false });
 				}
 
 				nNextState = GS_GAME_OVER2;
@@ -520,18 +1621,19 @@ private:
 			break;
 		}
 
-		// AI State Machine
-		if (bEnableComputerControl) {
+		// AI State Machine, idle if the worm it was given has gone
+		if (bEnableComputerControl && ControlledWorm() != nullptr) {
 			switch (nAIState) {
 			case AI_ASSESS_ENVIRONMENT: {
 				int nAction = rand() % 3;
 				if (nAction == 0) { // Play Defensive - move away from team{
 					// Find nearest ally, walk away from them
 					float fNearestAllyDistance = INFINITY; float fDirection = 0;
-					cWorm* origin = (cWorm*)pObjectUnderControl;
+					cWorm* origin = ControlledWorm();
 
-					for (auto w : vecTeams[nCurrentTeam].vecMembers) {
-						if (w != pObjectUnderControl) {
+					for (auto h : vecTeams[nCurrentTeam].vecMembers) {
+						cWorm* w = worms.Get(h);
+						if (w != nullptr && w != origin) {
 							if (fabs(w->px - origin->px) < fNearestAllyDistance) {
 								fNearestAllyDistance = fabs(w->px - origin->px);
 								fDirection = (w->px - origin->px) < 0.0f ? 1.0f : -1.0f;
@@ -546,13 +1648,13 @@ private:
 				}
 
 				if (nAction == 1) { // Play Ballsy - move towards middle{
-					cWorm* origin = (cWorm*)pObjectUnderControl;
+					cWorm* origin = ControlledWorm();
 					float fDirection = ((float)(nMapWidth / 2.0f) - origin->px) < 0.0f ? -1.0f : 1.0f;
 					fAISafePosition = origin->px + fDirection * 200.0f;
 				}
 
 				if (nAction == 2) { // Play Dumb - don't move
-					cWorm* origin = (cWorm*)pObjectUnderControl;
+					cWorm* origin = ControlledWorm();
 					fAISafePosition = origin->px;
 				}
 
@@ -564,7 +1666,7 @@ private:
 			break;
 
 			case AI_MOVE: {
-				cWorm* origin = (cWorm*)pObjectUnderControl;
+				cWorm* origin = ControlledWorm();
 				if (fTurnTime >= 8.0f && origin->px != fAISafePosition) {
 					// Walk towards target until it is in range					
 					if (fAISafePosition < origin->px && bGameIsStable) {
@@ -588,82 +1690,83 @@ private:
 				bAI_Jump = false;
 
 				// Select Team that is not itself
-				cWorm* origin = (cWorm*)pObjectUnderControl;
+				cWorm* origin = ControlledWorm();
 				int nCurrentTeam = origin->nTeam;
 				int nTargetTeam = 0;
+
+				// No one left to aim at, wait for the turn to run out and the game to end
+				bool bAnyTarget = false;
+				for (int t = 0; t < (int)vecTeams.size(); t++)
+					bAnyTarget |= t != nCurrentTeam && vecTeams[t].IsTeamAlive(worms);
+				if (!bAnyTarget) {
+					nAINextState = AI_ASSESS_ENVIRONMENT;
+					break;
+				}
+
 				do {
 					nTargetTeam = rand() % vecTeams.size();
-				} while (nTargetTeam == nCurrentTeam || !vecTeams[nTargetTeam].IsTeamAlive());
+				} while (nTargetTeam == nCurrentTeam || !vecTeams[nTargetTeam].IsTeamAlive(worms));
 
 				// Aggressive strategy is to aim for opponent unit with most health	
-				cWorm* mostHealthyWorm = vecTeams[nTargetTeam].vecMembers[0];
-				for (auto w : vecTeams[nTargetTeam].vecMembers)
-					if (w->fHealth > mostHealthyWorm->fHealth)
+				SlotHandle hMostHealthy;
+				cWorm* mostHealthyWorm = nullptr;
+				for (auto h : vecTeams[nTargetTeam].vecMembers) {
+					cWorm* w = worms.Get(h);
+					if (w != nullptr && (mostHealthyWorm == nullptr || w->fHealth > mostHealthyWorm->fHealth)) {
 						mostHealthyWorm = w;
+						hMostHealthy = h;
+					}
+				}
 
-				pAITargetWorm = mostHealthyWorm;
+				hAITargetWorm = hMostHealthy;
 				fAITargetX = mostHealthyWorm->px;
 				fAITargetY = mostHealthyWorm->py;
+				bPlanned = false;
 				nAINextState = AI_POSITION_FOR_TARGET;
 			}
 			break;
 
-			case AI_POSITION_FOR_TARGET: { // Calculate trajectory for target, if the worm needs to move, do so
-				cWorm* origin = (cWorm*)pObjectUnderControl;
-				float dy = -(fAITargetY - origin->py);
-				float dx = -(fAITargetX - origin->px);
-				float fSpeed = 30.0f;
-				float fGravity = 2.0f;
-
+			case AI_POSITION_FOR_TARGET: { // Plan a shot from here, if there's nothing worth firing, move towards target
+				cWorm* origin = ControlledWorm();
 				bAI_Jump = false;
 
-				float a = fSpeed * fSpeed * fSpeed * fSpeed - fGravity * (fGravity * dx * dx + 2.0f * dy * fSpeed * fSpeed);
+				// Wait for the worm and everything around it to settle before trying shots
+				if (!bGameIsStable)
+					break;
+
+				// Plan once the worm has settled, and again only once it has moved or the terrain
+				// has changed. Walking would otherwise replan every frame
+				if (!bPlanned || nPlannedBlasts != nBlastsApplied ||
+					fabs(origin->px - fPlannedX) > 0.5f || fabs(origin->py - fPlannedY) > 0.5f) {
+					planned = PlanShot(origin);
+					bPlanned = true;
+					fPlannedX = origin->px;
+					fPlannedY = origin->py;
+					nPlannedBlasts = nBlastsApplied;
+				}
+				sShot shot = planned;
 
-				if (a < 0) { // Target is out of range
-					if (fTurnTime >= 5.0f) {
-						// Walk towards target until it is in range
-						if (pAITargetWorm->px < origin->px && bGameIsStable) {
-							origin->fShootAngle = -3.14159f * 0.6f;
-							bAI_Jump = true;
-							nAINextState = AI_POSITION_FOR_TARGET;
-						}
+				// Target may have left the map since it was chosen, walk towards where it was
+				cWorm* target = worms.Get(hAITargetWorm);
+				float fTargetX = target != nullptr ? target->px : fAITargetX;
 
-						if (pAITargetWorm->px > origin->px && bGameIsStable) {
-							origin->fShootAngle = -3.14159f * 0.4f;
-							bAI_Jump = true;
-							nAINextState = AI_POSITION_FOR_TARGET;
-						}
-					}
-					else {
-						// Worm is stuck, so just fire in direction of enemy!
-						// Its dangerous to self, but may clear a blockage
-						fAITargetAngle = origin->fShootAngle;
-						fAITargetEnergy = 0.75f;
-						nAINextState = AI_AIM;
-					}
+				if (shot.fScore <= 0.0f && fTurnTime >= 5.0f) {
+					// Walk towards target until it is in range
+					origin->fShootAngle = fTargetX < origin->px ? -3.14159f * 0.6f : -3.14159f * 0.4f;
+					bAI_Jump = true;
 				}
 				else {
-					// Worm is close enough, calculate trajectory
-					float b1 = fSpeed * fSpeed + sqrtf(a);
-					float b2 = fSpeed * fSpeed - sqrtf(a);
-
-					float fTheta1 = atanf(b1 / (fGravity * dx)); // Max Height
-					float fTheta2 = atanf(b2 / (fGravity * dx)); // Min Height
-
-					// We'll use max as its a greater chance of avoiding obstacles
-					fAITargetAngle = fTheta1 - (dx > 0 ? 3.14159f : 0.0f);
-					float fFireX = cosf(fAITargetAngle);
-					float fFireY = sinf(fAITargetAngle);
-
-					// AI is clamped to 3/4 power
-					fAITargetEnergy = 0.75f;
+					// Best shot found, or no time left to look for a better one. Even a poor
+					// shot may clear a blockage
+					fAITargetAngle = shot.fAngle;
+					fAITargetEnergy = shot.fEnergy;
 					nAINextState = AI_AIM;
 				}
 			}
 			break;
 
 			case AI_AIM: { // Line up aim cursor
-				cWorm* worm = (cWorm*)pObjectUnderControl;
+				cWorm* worm = ControlledWorm();
 
 				bAI_AimLeft = false;
 				bAI_AimRight = false;
@@ -676,8 +1779,11 @@ private:
 
 				// Once cursors are aligned, fire - some noise could be
 				// included here to give the AI a varying accuracy, and the
-				// magnitude of the noise could be linked to game difficulty
-				if (fabs(worm->fShootAngle - fAITargetAngle) <= 0.001f) {
+				// magnitude of the noise could be linked to game difficulty.
+				// Aim moves 1 radian per second, so allow one frame's worth of error
+				// or a steady frame rate can step over the target forever
+				if (fabs(worm->fShootAngle - fAITargetAngle) <= 1.0f * fElapsedTime) {
+					worm->fShootAngle = fAITargetAngle;
 					bAI_AimLeft = false;
 					bAI_AimRight = false;
 					fEnergyLevel = 0.0f;
@@ -709,28 +1815,27 @@ private:
 		// Decrease Turn Time
 		fTurnTime -= fElapsedTime;
 
-		if (pObjectUnderControl != nullptr) {
-			pObjectUnderControl->ax = 0.0f;
+		if (cWorm* worm = ControlledWorm()) {
+			worm->ax = 0.0f;
 
-			if (pObjectUnderControl->bStable) {
+			if (worm->bStable) {
 				if ((bEnablePlayerControl && m_keys[L'Z'].bPressed) || (bEnableComputerControl && bAI_Jump)) {
-					float a = ((cWorm*)pObjectUnderControl)->fShootAngle;
+					float a = worm->fShootAngle;
 
-					pObjectUnderControl->vx = 4.0f * cosf(a);
-					pObjectUnderControl->vy = 8.0f * sinf(a);
-					pObjectUnderControl->bStable = false;
+					worm->vx = 4.0f * cosf(a);
+					worm->vy = 8.0f * sinf(a);
+					worm->bStable = false;
+					WakeObject(worm);
 
 					bAI_Jump = false;
 				}
 
 				if ((bEnablePlayerControl && m_keys[L'S'].bHeld) || (bEnableComputerControl && bAI_AimRight)) {
-					cWorm* worm = (cWorm*)pObjectUnderControl;
 					worm->fShootAngle += 1.0f * fElapsedTime;
 					if (worm->fShootAngle > 3.14159f) worm->fShootAngle -= 3.14159f * 2.0f;
 				}
 
 				if ((bEnablePlayerControl && m_keys[L'A'].bHeld) || (bEnableComputerControl && bAI_AimLeft)) {
-					cWorm* worm = (cWorm*)pObjectUnderControl;
 					worm->fShootAngle -= 1.0f * fElapsedTime;
 					if (worm->fShootAngle < -3.14159f) worm->fShootAngle += 3.14159f * 2.0f;
 				}
@@ -759,16 +1864,14 @@ private:
 				}
 			}
 
-			if (pCameraTrackingObject != nullptr) {
-				fCameraPosXTarget = pCameraTrackingObject->px - ScreenWidth() / 2;
-				fCameraPosYTarget = pCameraTrackingObject->py - ScreenHeight() / 2;
+			if (cPhysicsObject* pCameraTrackingObject = CameraTarget()) {
+				fCameraPosXTarget = pCameraTrackingObject->px - ScreenWidth() * fZoom / 2.0f;
+				fCameraPosYTarget = pCameraTrackingObject->py - ScreenHeight() * fZoom / 2.0f;
 				fCameraPosX += (fCameraPosXTarget - fCameraPosX) * 15.0f * fElapsedTime;
 				fCameraPosY += (fCameraPosYTarget - fCameraPosY) * 15.0f * fElapsedTime;
 			}
 
 			if (bFireWeapon) {
-				cWorm* worm = (cWorm*)pObjectUnderControl;
-
 				// Get Weapon Origin
 				float ox = worm->px;
 				float oy = worm->py;
@@ -778,9 +1881,7 @@ private:
 				float dy = sinf(worm->fShootAngle);
 
 				// Create Weapon Object
-				cMissile* m = new cMissile(ox, oy, dx * 40.0f * fEnergyLevel, dy * 40.0f * fEnergyLevel);
-				pCameraTrackingObject = m;
-				listObjects.push_back(unique_ptr<cMissile>(m));
+				commands.vecSpawn.push_back({ ox, oy, dx * 40.0f * fEnergyLevel, dy * 40.0f * fEnergyLevel, true });
 
 				// Reset flags involved with firing weapon
 				bFireWeapon = false;
@@ -793,184 +1894,185 @@ private:
 			}
 		}
 
-		// Clamp map boundaries
-		if (fCameraPosX < 0)
-			fCameraPosX = 0;
-		if (fCameraPosX >= nMapWidth - ScreenWidth())
-			fCameraPosX = nMapWidth - ScreenWidth();
-		if (fCameraPosY < 0)
-			fCameraPosY = 0;
-		if (fCameraPosY >= nMapHeight - ScreenHeight())
-			fCameraPosY = nMapHeight - ScreenHeight();
-
-		// 10 physics iteration per frame since drawing is the slowest
-		for (int z = 0; z < 10; z++) {
-			// Update physics of all physical objects
-			for (auto& p : listObjects) {
-				// Apply Gravity
-				p->ay += 2.0f;
-
-				// Update Velocity
-				p->vx += p->ax * fElapsedTime;
-				p->vy += p->ay * fElapsedTime;
-
-				// Update Position
-				float fPotentialX = p->px + p->vx * fElapsedTime;
-				float fPotentialY = p->py + p->vy * fElapsedTime;
-
-				// Reset Acceleration
-				p->ax = 0.0f;
-				p->ay = 0.0f;
-				p->bStable = false;
-
-				// Collision Check With Map
-				float fAngle = atan2f(p->vy, p->vx);
-				float fResponseX = 0.0f;
-				float fResponseY = 0.0f;
-				bool bCollision = false;
-
-				for (float r = fAngle - 3.14159f / 2.0f; r < fAngle + 3.14159f / 2.0f; r += 3.14159f / 4.0f) { // can do something better to make points a unit distance between each other  //5.48795f
-					// Iterate through semicircle of objects radius rotated to direction of travel
-					float fTestPosX = (p->radius) * cosf(r) + fPotentialX;
-					float fTestPosY = (p->radius) * sinf(r) + fPotentialY;
-
-					// Clamp to size of map
-					if (fTestPosX >= nMapWidth)
-						fTestPosX = nMapWidth - 1;
-					if (fTestPosY >= nMapHeight)
-						fTestPosY = nMapHeight - 1;
-					if (fTestPosX < 0)
-						fTestPosX = 0;
-					if (fTestPosY < 0)
-						fTestPosY = 0;
-
-					// Test if any points on semicircle intersect with terrain
-					if (map[(int)fTestPosY * nMapWidth + (int)fTestPosX] > 0) {
-						// Accumulate collision points to give an escape response vector
-						// Effectively, normal to the areas of contact
-						fResponseX += fPotentialX - fTestPosX;
-						fResponseY += fPotentialY - fTestPosY;
-						bCollision = true;
-					}
-				}
+		// Ease the zoom toward its target, keeping the middle of the screen where it is
+		float fZoomTarget = bZoomOut ? ZoomWholeMap() : fZoomNear;
+		if (fZoom != fZoomTarget) {
+			float fCentreX = fCameraPosX + ScreenWidth() * fZoom / 2.0f;
+			float fCentreY = fCameraPosY + ScreenHeight() * fZoom / 2.0f;
+			fZoom += (fZoomTarget - fZoom) * min(1.0f, 8.0f * fElapsedTime);
+			if (fabsf(fZoomTarget - fZoom) < 0.01f)
+				fZoom = fZoomTarget;
+			fCameraPosX = fCentreX - ScreenWidth() * fZoom / 2.0f;
+			fCameraPosY = fCentreY - ScreenHeight() * fZoom / 2.0f;
+		}
 
-				// Calculate magnitudes of response and velocity vectors
-				float fMagVelocity = sqrtf(p->vx * p->vx + p->vy * p->vy);
-				float fMagResponse = sqrtf(fResponseX * fResponseX + fResponseY * fResponseY);
-
-				if (p->px < 0 || p->px > nMapWidth || p->py < 0 || p->py > nMapHeight)
-					p->bDead = true;
-
-				// Find angle of collision
-				if (bCollision) {
-					// Force object to stable, this stops the object penetrating the terrain
-					p->bStable = true;
-
-					// Calculate reflection vector of objects velocity vector, using response vector
-					float dot = p->vx * (fResponseX / fMagResponse) + p->vy * (fResponseY / fMagResponse); // dot product
-					// Use friction coefficient to dampen response (approximating energy loss)
-					p->vx = p->fFriction * (-2.0f * dot * (fResponseX / fMagResponse) + p->vx);
-					p->vy = p->fFriction * (-2.0f * dot * (fResponseY / fMagResponse) + p->vy);
-
-					// Some objects will "die" after several bounces
-					if (p->nBounceBeforeDeath > 0) {
-						p->nBounceBeforeDeath--;
-						p->bDead = p->nBounceBeforeDeath == 0;
-
-						if (p->bDead) {
-							// Action upon object death
-							// == 0 Nothing
-							// > 0 Explosion
-							int nResponse = p->BounceDeathAction();
-							if (nResponse > 0) {
-								Boom(p->px, p->py, nResponse);
-								pCameraTrackingObject = nullptr;
-							}
-						}
-					}
-				}
+		// Clamp map boundaries, a view bigger than the map is centred on it
+		float fViewWidth = ScreenWidth() * fZoom;
+		float fViewHeight = ScreenHeight() * fZoom;
+		if (fViewWidth >= nMapWidth)
+			fCameraPosX = (nMapWidth - fViewWidth) / 2.0f;
+		else {
+			if (fCameraPosX < 0)
+				fCameraPosX = 0;
+			if (fCameraPosX >= nMapWidth - fViewWidth)
+				fCameraPosX = nMapWidth - fViewWidth;
+		}
+		if (fViewHeight >= nMapHeight)
+			fCameraPosY = (nMapHeight - fViewHeight) / 2.0f;
+		else {
+			if (fCameraPosY < 0)
+				fCameraPosY = 0;
+			if (fCameraPosY >= nMapHeight - fViewHeight)
+				fCameraPosY = nMapHeight - fViewHeight;
+		}
 
-				else {
-					p->px = fPotentialX;
-					p->py = fPotentialY;
-				}
+		// Planning shows as its own phase, leave it out of control's time
+		float fControlTime = chrono::duration<float, milli>(chrono::steady_clock::now() - tpControl).count();
+		m_profiler.AddTime(nPhaseControl, fControlTime - (m_profiler.FrameTime(nPhasePlan) - fPlanTimeBefore));
+
+		// Turn this frame's real time into whole physics ticks. A little slack keeps a frame time
+		// that is an exact number of ticks from rounding down to one less
+		fPhysicsAccumulator += fElapsedTime * (float)nPhysicsTickRate;
+		int nTicks = (int)(fPhysicsAccumulator + 0.001f);
+		fPhysicsAccumulator -= (float)nTicks;
+		if (nTicks > nMaxPhysicsTicks) {
+			// Too far behind to catch up, the game slows down rather than stalling
+			nTicks = nMaxPhysicsTicks;
+			fPhysicsAccumulator = 0.0f;
+		}
 
-				// Turn off movement when tiny
-				if (fMagVelocity < 0.1f)
-					p->bStable = true;
+		// Drawing trails the simulation by up to a tick, blending the last two by what is left over
+		fPhysicsAlpha = min(1.0f, max(0.0f, fPhysicsAccumulator));
+		m_profiler.SetCount(nCounterTicks, nTicks);
+
+		// Whatever the controls and game state asked for this frame happens before any ticks, so a
+		// missile just fired is in flight even on a frame too short to tick at all
+		ExecuteCommands();
+
+		const float fStep = fPhysicsTimeScale / (float)nPhysicsTickRate;
+		for (int z = 0; z < nTicks; z++) {
+			ProfileScope scope(m_profiler, nPhasePhysics);
+
+			// Update physics of all physical objects, in ranges spread over the worker threads. Each
+			// range records its commands separately and they're joined in range order afterwards, so
+			// the outcome is the same however many threads there are
+			vecStepObjects.clear();
+			ForEachObjectRef([&](cPhysicsObject& o, sObjectRef ref) {
+				if (!o.bAsleep)
+					vecStepObjects.push_back({ &o, ref });
+			});
+			int nRanges = RangeCount((int)vecStepObjects.size(), 32);
+			vecStepCommands.resize(nRanges);
+			ParallelRanges(nRanges, (int)vecStepObjects.size(), [&](int nRange, int i1, int i2) {
+				for (int i = i1; i < i2; i++)
+					StepObjectAdaptive(vecStepObjects[i].p, vecStepObjects[i].ref, fStep, vecStepCommands[nRange]);
+			});
+
+			nRanges = RangeCount(debris.Count(), 256);
+			debris.BeginStep();
+			ParallelRanges(nRanges, debris.Count(), [&](int nRange, int i1, int i2) {
+				debris.Step(fStep, terrain, i1, i2);
+			});
+			debris.EndStep();
+
+			for (auto& c : vecStepCommands) {
+				commands.Append(c);
+				c.Clear();
 			}
 
-			// Remove dead objects from the list, so they are not processed further. As the object
-			// is a unique pointer, it will go out of scope too, deleting the object automatically
-			listObjects.remove_if([](unique_ptr<cPhysicsObject> &o) { return o->bDead; });
-		}
+			for (auto& s : vecStepObjects)
+				if (s.p->fRestTime >= fSleepTime)
+					SleepObject(s.p);
 
-		// Draw Landscape
-		if (!bZoomOut) {
-			for (int x = 0; x < ScreenWidth(); x++)
-				for (int y = 0; y < ScreenHeight(); y++) {
-					switch (map[(y + (int)fCameraPosY) * nMapWidth + (x + (int)fCameraPosX)]) {
-					case -1:Draw(x, y, PIXEL_SOLID, FG_DARK_BLUE); break;
-					case -2:Draw(x, y, PIXEL_QUARTER, FG_BLUE | BG_DARK_BLUE); break;
-					case -3:Draw(x, y, PIXEL_HALF, FG_BLUE | BG_DARK_BLUE); break;
-					case -4:Draw(x, y, PIXEL_THREEQUARTERS, FG_BLUE | BG_DARK_BLUE); break;
-					case -5:Draw(x, y, PIXEL_SOLID, FG_BLUE); break;
-					case -6:Draw(x, y, PIXEL_QUARTER, FG_CYAN | BG_BLUE); break;
-					case -7:Draw(x, y, PIXEL_HALF, FG_CYAN | BG_BLUE); break;
-					case -8:Draw(x, y, PIXEL_THREEQUARTERS, FG_CYAN | BG_BLUE); break;
-					case 0:	Draw(x, y, PIXEL_SOLID, FG_CYAN); break;
-					case 1:	Draw(x, y, PIXEL_SOLID, FG_DARK_GREEN);	break;
-					}
-				}
+			CollideBodies();
+			ExecuteCommands();
+		}
 
-			// Draw objects - they draw themselves
-			for (auto& p : listObjects) {
-				p->Draw(this, fCameraPosX, fCameraPosY);
+		// Draw Landscape and objects. The screen is cut into horizontal bands drawn in parallel,
+		// each band draws its own terrain rows and then whichever objects reach into it.
+		// Anything further than its margin from a band can't touch it. Objects shrink to
+		// pixels once zoomed out far enough
+		auto ScreenX = [&](float x) { return (x - fCameraPosX) / fZoom; };
+		auto ScreenY = [&](float y) { return (y - fCameraPosY) / fZoom; };
+		bool bPixel = fZoom >= 2.0f;
+
+		auto BandsReached = [&](float sy, float fMargin, int& b1, int& b2) {
+			if (sy + fMargin < 0.0f || sy - fMargin >= (float)ScreenHeight())
+				return false;
+			b1 = BandOf((int)floorf(sy - fMargin));
+			b2 = BandOf((int)floorf(sy + fMargin));
+			return true;
+		};
+		vecDrawObjects.clear();
+		ForEachObject([&](cPhysicsObject& o) { vecDrawObjects.push_back(&o); });
+		objectBins.Build(BandCount(), (int)vecDrawObjects.size(), [&](int i, int& b1, int& b2) {
+			return BandsReached(ScreenY(vecDrawObjects[i]->DrawY(fPhysicsAlpha)), 16.0f, b1, b2);
+		});
+		debrisBins.Build(BandCount(), debris.Count(), [&](int i, int& b1, int& b2) {
+			return BandsReached(debris.ScreenY(i, fCameraPosY, fZoom, fPhysicsAlpha), 2.0f, b1, b2);
+		});
+
+		vecBandTerrainTime.assign(BandCount(), 0.0f);
+		vecBandObjectsTime.assign(BandCount(), 0.0f);
+		ParallelBands([&](int nBand, int y1, int y2) {
+			auto tpTerrain = chrono::steady_clock::now();
+			if (fZoom == 1.0f) {
+				// Copied out of the baked terrain a row at a time
+				for (int y = y1; y < y2; y++)
+					terrainLayer.DrawRow(this, (int)fCameraPosX, y + (int)fCameraPosY, ScreenWidth(), 0, y);
+			}
+			else {
+				// From the nearest level of the coverage pyramid, stepping in 16.16 fixed point
+				int nLevel = max(0, min(cTerrain::MIP_LEVELS - 1, (int)roundf(log2f(fZoom))));
+				int u = (int)(fCameraPosX * 65536.0f);
+				int du = (int)(fZoom * 65536.0f);
+				for (int y = y1; y < y2; y++)
+					terrainLayer.DrawRowScaled(this, u, du, (int)floorf(fCameraPosY + y * fZoom), nLevel, y, ScreenWidth());
+			}
+			auto tpObjects = chrono::steady_clock::now();
+			vecBandTerrainTime[nBand] = chrono::duration<float, milli>(tpObjects - tpTerrain).count();
+
+			// Draw objects - they draw themselves, wireframes all go out together at the end
+			cWorm* worm = ControlledWorm();
+			BeginWireFrameBatch();
+			objectBins.ForEach(nBand, [&](int i) {
+				cPhysicsObject* p = vecDrawObjects[i];
+				float ix = p->DrawX(fPhysicsAlpha);
+				float iy = p->DrawY(fPhysicsAlpha);
+
+				// Objects draw themselves at px, py, the offset moves them to ix, iy
+				if (fZoom == 1.0f)
+					p->Draw(this, fCameraPosX + p->px - ix, fCameraPosY + p->py - iy);
+				else
+					p->Draw(this, p->px - ScreenX(ix), p->py - ScreenY(iy), bPixel);
 
-				cWorm* worm = (cWorm*)pObjectUnderControl;
-				if (p.get() == worm) {
+				if (p == worm && !bPixel) {
 					// Draw Crosshair
-					float cx = worm->px + 8.0f * cosf(worm->fShootAngle) - fCameraPosX;
-					float cy = worm->py + 8.0f * sinf(worm->fShootAngle) - fCameraPosY;
+					float cx = ScreenX(ix + 8.0f * cosf(worm->fShootAngle));
+					float cy = ScreenY(iy + 8.0f * sinf(worm->fShootAngle));
 
 					Draw(cx, cy, PIXEL_SOLID, FG_BLACK);
 					Draw(cx + 1, cy, PIXEL_SOLID, FG_BLACK);
 					Draw(cx - 1, cy, PIXEL_SOLID, FG_BLACK);
 					Draw(cx, cy + 1, PIXEL_SOLID, FG_BLACK);
 					Draw(cx, cy - 1, PIXEL_SOLID, FG_BLACK);
-					 
-					for (int i = 0; i < 11 * fEnergyLevel; i++) {
-						Draw(worm->px - 5 + i - fCameraPosX, worm->py - 12 - fCameraPosY, PIXEL_SOLID, FG_GREEN);
-						Draw(worm->px - 5 + i - fCameraPosX, worm->py - 11 - fCameraPosY, PIXEL_SOLID, FG_RED);
-					}
-				}
-			}
-		}
 
-		else {
-			for (int x = 0; x < ScreenWidth(); x++)
-				for (int y = 0; y < ScreenHeight(); y++) {
-					float fx = (float)x / (float)ScreenWidth() * (float)nMapWidth;
-					float fy = (float)y / (float)ScreenHeight() * (float)nMapHeight;
-
-					switch (map[((int)fy) * nMapWidth + ((int)fx)])
-					{
-					case -1:Draw(x, y, PIXEL_SOLID, FG_DARK_BLUE); break;
-					case -2:Draw(x, y, PIXEL_QUARTER, FG_BLUE | BG_DARK_BLUE); break;
-					case -3:Draw(x, y, PIXEL_HALF, FG_BLUE | BG_DARK_BLUE); break;
-					case -4:Draw(x, y, PIXEL_THREEQUARTERS, FG_BLUE | BG_DARK_BLUE); break;
-					case -5:Draw(x, y, PIXEL_SOLID, FG_BLUE); break;
-					case -6:Draw(x, y, PIXEL_QUARTER, FG_CYAN | BG_BLUE); break;
-					case -7:Draw(x, y, PIXEL_HALF, FG_CYAN | BG_BLUE); break;
-					case -8:Draw(x, y, PIXEL_THREEQUARTERS, FG_CYAN | BG_BLUE); break;
-					case 0:	Draw(x, y, PIXEL_SOLID, FG_CYAN); break;
-					case 1:	Draw(x, y, PIXEL_SOLID, FG_DARK_GREEN);	break;
-					}
+					int nBar = (int)ceilf(11 * fEnergyLevel);
+					DrawSpan(ScreenX(ix - 5), ScreenX(ix - 5) + nBar, ScreenY(iy - 12), PIXEL_SOLID, FG_GREEN);
+					DrawSpan(ScreenX(ix - 5), ScreenX(ix - 5) + nBar, ScreenY(iy - 11), PIXEL_SOLID, FG_RED);
 				}
-
-			for (auto& p : listObjects)
-				p->Draw(this, p->px - (p->px / (float)nMapWidth) * (float)ScreenWidth(),
-					p->py - (p->py / (float)nMapHeight) * (float)ScreenHeight(), true);
+			});
+			debrisBins.ForEach(nBand, [&](int i) {
+				debris.Draw(this, i, fCameraPosX, fCameraPosY, fZoom, fPhysicsAlpha);
+			});
+			EndWireFrameBatch();
+			vecBandObjectsTime[nBand] = chrono::duration<float, milli>(chrono::steady_clock::now() - tpObjects).count();
+		});
+
+		// Phase times are summed over the bands, so they read as CPU time rather than wall time
+		for (int i = 0; i < (int)vecBandTerrainTime.size(); i++) {
+			m_profiler.AddTime(nPhaseTerrain, vecBandTerrainTime[i]);
+			m_profiler.AddTime(nPhaseObjects, vecBandObjectsTime[i]);
 		}
 
 		/*for (int x = 0; x < ScreenWidth(); x++)
@@ -1008,23 +2110,26 @@ private:
 			}
 		}*/
 
+		m_profiler.SetCount(nCounterObjects, (int)(worms.Size() + missiles.Size()));
+		m_profiler.SetCount(nCounterDebris, debris.Count());
+		m_profiler.SetCount(nCounterChunks, terrain.AllocatedChunks());
+
 		// Check for game state stability
-		bGameIsStable = true;
-		for (auto& p : listObjects)
-			if (!p->bStable) {
-				bGameIsStable = false;
-				break;
-			}
+		bGameIsStable = nAwakeObjects == 0 && debris.AllStable();
 		// This is for Debugging
 		//if (bGameIsStable)
 		//	Fill(2, 2, 6, 6, PIXEL_SOLID, FG_RED);
 
+		// Nothing moving and nobody in control, let the engine throttle right down
+		m_bIdle = bGameIsStable && !bEnablePlayerControl && !bEnableComputerControl;
+
 		// Draw Team Health Bars
 		for (size_t t = 0; t < vecTeams.size(); t++) {
 			float fTotalHealth = 0.0f;
 			float fMaxHealth = (float)vecTeams[t].nTeamSize;
-			for (auto w : vecTeams[t].vecMembers) // Accumulate team health
-				fTotalHealth += w->fHealth;
+			for (auto h : vecTeams[t].vecMembers) // Accumulate team health
+				if (cWorm* w = worms.Get(h))
+					fTotalHealth += w->fHealth;
 
 			int cols[] = { FG_RED, FG_BLUE, FG_MAGENTA, FG_GREEN };
 			Fill(4, 4 + t * 4, (fTotalHealth / fMaxHealth) * (float)(ScreenWidth() - 8) + 4, 4 + t * 4 + 3, PIXEL_SOLID, cols[t]);
@@ -1060,58 +2165,500 @@ private:
 		return true;
 	}
 
-	void Boom(float fWorldX, float fWorldY, float fRadius) {
-		// Destroy terrain
-		auto CircleBresenham = [&](int xc, int yc, int r) { // World space (bitmap bg)
+	// Shade the sky according to altitude, -8..-1 over the top third of the map and 0 below
+	char SkyShade(int y) {
+		if ((float)y < (float)nMapHeight / 3.0f)
+			return (char)((-8.0f * ((float)y / (nMapHeight / 3.0f))) - 1.0f);
+		return 0;
+	}
+
+	// Terrain values are -8..-1 for shades of sky, 0 for plain sky and 1 for land
+	CHAR_INFO TerrainCell(char v) {
+		auto Cell = [](wchar_t c, short col) { CHAR_INFO ci; ci.Char.UnicodeChar = c; ci.Attributes = col; return ci; };
+		switch (v) {
+		case -1:return Cell(PIXEL_SOLID, FG_DARK_BLUE);
+		case -2:return Cell(PIXEL_QUARTER, FG_BLUE | BG_DARK_BLUE);
+		case -3:return Cell(PIXEL_HALF, FG_BLUE | BG_DARK_BLUE);
+		case -4:return Cell(PIXEL_THREEQUARTERS, FG_BLUE | BG_DARK_BLUE);
+		case -5:return Cell(PIXEL_SOLID, FG_BLUE);
+		case -6:return Cell(PIXEL_QUARTER, FG_CYAN | BG_BLUE);
+		case -7:return Cell(PIXEL_HALF, FG_CYAN | BG_BLUE);
+		case -8:return Cell(PIXEL_THREEQUARTERS, FG_CYAN | BG_BLUE);
+		case 0:	return Cell(PIXEL_SOLID, FG_CYAN);
+		default:return Cell(PIXEL_SOLID, FG_DARK_GREEN);
+		}
+	}
+
+	// Zoom at which the whole map fits on screen
+	float ZoomWholeMap() {
+		return max(1.0f, max((float)nMapWidth / (float)ScreenWidth(), (float)nMapHeight / (float)ScreenHeight()));
+	}
+
+	// Terrain changes only when explosions go off, so its cells are baked once and kept
+	void BakeTerrain() {
+		vector<CHAR_INFO> vecSky(nMapHeight);
+		for (int y = 0; y < nMapHeight; y++)
+			vecSky[y] = TerrainCell(SkyShade(y));
+		terrainLayer.Create(terrain, TerrainCell(1), vecSky);
+	}
+
+	// Some objects will "die" after several bounces
+	void Bounced(cPhysicsObject* p, sObjectRef ref, sCommandBuffer& cmd) {
+		if (p->nBounceBeforeDeath > 0) {
+			p->nBounceBeforeDeath--;
+
+			if (p->nBounceBeforeDeath == 0) {
+				cmd.vecKill.push_back(ref);
+
+				// Action upon object death
+				// == 0 Nothing
+				// > 0 Explosion
+				int nResponse = p->BounceDeathAction();
+				if (nResponse > 0)
+					cmd.vecExplode.push_back({ p->px, p->py, (float)nResponse });
+			}
+		}
+	}
+
+	// A tick split into as many steps as the object's speed needs, so it moves no more than
+	// half its radius at a time. Objects at rest or drifting take the whole tick in one go,
+	// only the fast ones pay for more
+	void StepObjectAdaptive(cPhysicsObject* p, sObjectRef ref, float fStep, sCommandBuffer& cmd) {
+		p->lx = p->px;
+		p->ly = p->py;
+
+		float fSpeed = sqrtf(p->vx * p->vx + p->vy * p->vy);
+		int nSteps = min(nMaxSubsteps, max(1, (int)ceilf(fSpeed * fStep / (0.5f * p->radius))));
+		for (int s = 0; s < nSteps; s++) {
+			// Nothing more to do once it has been killed off
+			size_t nKills = cmd.vecKill.size();
+			StepObject(p, ref, fStep / nSteps, cmd);
+			if (cmd.vecKill.size() != nKills)
+				break;
+		}
+	}
+
+	// Integrate one object over a physics step and bounce it off the terrain. Touches nothing
+	// but the object itself, so any number can be stepped at once
+	void StepObject(cPhysicsObject* p, sObjectRef ref, float fStep, sCommandBuffer& cmd) {
+		// Apply Gravity
+		p->ay += 2.0f;
+
+		// Update Velocity
+		p->vx += p->ax * fStep;
+		p->vy += p->ay * fStep;
+
+		// Update Position
+		float fPotentialX = p->px + p->vx * fStep;
+		float fPotentialY = p->py + p->vy * fStep;
+
+		// Reset Acceleration
+		p->ax = 0.0f;
+		p->ay = 0.0f;
+		p->bStable = false;
+
+		// Collision Check With Map. The distance field gives how far the object's centre is
+		// from the surface and which way is out, it has hit if it overlaps the land while
+		// moving into it. Buried deeper than the field reaches, the only way is back
+		float fNormalX, fNormalY;
+		cmd.nSamples++;
+		float fDistance = terrain.Distance(fPotentialX, fPotentialY, fNormalX, fNormalY);
+		if (fNormalX == 0.0f && fNormalY == 0.0f && fDistance < 0.0f) {
+			float fSpeed = sqrtf(p->vx * p->vx + p->vy * p->vy);
+			fNormalX = fSpeed > 0.0f ? -p->vx / fSpeed : 0.0f;
+			fNormalY = fSpeed > 0.0f ? -p->vy / fSpeed : -1.0f;
+		}
+		bool bCollision = fDistance < p->radius && p->vx * fNormalX + p->vy * fNormalY < 0.0f;
+
+		// Anything moving further than its radius in a tick could pass clean through a thin
+		// wall, so its path is traced too. It stops where the path meets land
+		float fMoveX = fPotentialX - p->px;
+		float fMoveY = fPotentialY - p->py;
+		if (!bCollision && fMoveX * fMoveX + fMoveY * fMoveY > p->radius * p->radius) {
+			float hx, hy;
+			cmd.nSamples++;
+			if (terrain.Sweep(p->px, p->py, fPotentialX, fPotentialY, hx, hy, fNormalX, fNormalY)) {
+				bCollision = true;
+				p->px = hx;
+				p->py = hy;
+			}
+		}
+
+		// Calculate magnitude of velocity vector
+		float fMagVelocity = sqrtf(p->vx * p->vx + p->vy * p->vy);
+
+		if (p->px < 0 || p->px > nMapWidth || p->py < 0 || p->py > nMapHeight)
+			cmd.vecKill.push_back(ref);
+
+		// Find angle of collision
+		if (bCollision) {
+			// Force object to stable, this stops the object penetrating the terrain
+			p->bStable = true;
+
+			// Calculate reflection vector of objects velocity vector about the surface normal
+			float dot = p->vx * fNormalX + p->vy * fNormalY; // dot product
+			// Use friction coefficient to dampen response (approximating energy loss)
+			p->vx = p->fFriction * (-2.0f * dot * fNormalX + p->vx);
+			p->vy = p->fFriction * (-2.0f * dot * fNormalY + p->vy);
+
+			Bounced(p, ref, cmd);
+		}
+
+		else {
+			p->px = fPotentialX;
+			p->py = fPotentialY;
+		}
+
+		// Turn off movement when tiny
+		if (fMagVelocity < 0.1f)
+			p->bStable = true;
+
+		// Stable only says it once stopped, something sliding or rolling since is still moving
+		bool bAtRest = p->bStable && p->vx * p->vx + p->vy * p->vy < fSleepSpeed * fSleepSpeed;
+		p->fRestTime = bAtRest ? p->fRestTime + fStep : 0.0f;
+	}
+
+	// Gather every body and bin it in the spatial hash
+	void IndexBodies() {
+		vecBodies.clear();
+		fMaxBodyRadius = cDebrisSystem::RADIUS;
+		ForEachObjectRef([&](cPhysicsObject& o, sObjectRef ref) {
+			vecBodies.push_back({ &o.px, &o.py, &o.vx, &o.vy, o.radius, o.fFriction, &o, -1, ref });
+			fMaxBodyRadius = max(fMaxBodyRadius, o.radius);
+		});
+		for (int i = 0; i < debris.Count(); i++)
+			vecBodies.push_back({ &debris.px[i], &debris.py[i], &debris.vx[i], &debris.vy[i],
+				cDebrisSystem::RADIUS, cDebrisSystem::FRICTION, nullptr, i, sObjectRef{} });
+
+		bodyHash.Clear();
+		for (int i = 0; i < (int)vecBodies.size(); i++)
+			bodyHash.Add(i, *vecBodies[i].px, *vecBodies[i].py);
+		bodyHash.Build();
+	}
+
+	void SleepObject(cPhysicsObject* p) {
+		p->bAsleep = true;
+		p->vx = 0.0f;
+		p->vy = 0.0f;
+		p->lx = p->px;
+		p->ly = p->py;
+		nAwakeObjects--;
+	}
+
+	void WakeObject(cPhysicsObject* p) {
+		p->fRestTime = 0.0f;
+		if (p->bAsleep) {
+			p->bAsleep = false;
+			nAwakeObjects++;
+		}
+	}
+
+	// Anything pushed fast enough is no longer at rest, a sleeper nudged any less stays put
+	void WakeBody(const sBody& body) {
+		if (sqrtf(*body.vx * *body.vx + *body.vy * *body.vy) < 0.1f) {
+			if (body.pObject != nullptr && body.pObject->bAsleep) {
+				*body.vx = 0.0f;
+				*body.vy = 0.0f;
+			}
+			return;
+		}
+		if (body.pObject != nullptr) {
+			body.pObject->bStable = false;
+			WakeObject(body.pObject);
+		}
+		else
+			debris.Wake(body.nDebris);
+	}
+
+	// Circle against circle between everything that moves. Overlapping pairs are found in
+	// parallel through the spatial hash, then resolved one at a time in a fixed order
+	void CollideBodies() {
+		IndexBodies();
+		int n = (int)vecBodies.size();
+		int nRanges = RangeCount(n, 256);
+		vecRangeContacts.resize(nRanges);
+		ParallelRanges(nRanges, n, [&](int nRange, int i1, int i2) {
+			vector<sContact>& vecContacts = vecRangeContacts[nRange];
+			vecContacts.clear();
+			for (int i = i1; i < i2; i++) {
+				const sBody& a = vecBodies[i];
+				bodyHash.Query(*a.px, *a.py, a.r + fMaxBodyRadius, [&](int j) {
+					if (j <= i)
+						return;
+					const sBody& b = vecBodies[j];
+					float dx = *b.px - *a.px;
+					float dy = *b.py - *a.py;
+					if (dx * dx + dy * dy < (a.r + b.r) * (a.r + b.r))
+						vecContacts.push_back({ i, j });
+				});
+			}
+		});
+
+		for (int r = 0; r < nRanges; r++) {
+			m_profiler.Count(nCounterContacts, (int)vecRangeContacts[r].size());
+			for (auto& c : vecRangeContacts[r])
+				ResolveContact(vecBodies[c.a], vecBodies[c.b]);
+		}
+	}
+
+	// Bodies moving into each other trade momentum, mass going with area, and lose some of it
+	// as they would bouncing off the terrain. Two objects meeting is a bounce for both, so a
+	// missile goes off against a worm
+	void ResolveContact(const sBody& a, const sBody& b) {
+		float dx = *b.px - *a.px;
+		float dy = *b.py - *a.py;
+		float fDist = sqrtf(dx * dx + dy * dy);
+
+		// Right on top of each other, like a missile just leaving its worm, there's no telling
+		// which way is apart
+		if (fDist < 0.0001f)
+			return;
+
+		float nx = dx / fDist;
+		float ny = dy / fDist;
+		float fClosing = (*b.vx - *a.vx) * nx + (*b.vy - *a.vy) * ny;
+		if (fClosing >= 0.0f)
+			return;
+
+		float fInvMassA = 1.0f / (a.r * a.r);
+		float fInvMassB = 1.0f / (b.r * b.r);
+		float fImpulse = -(1.0f + min(a.fFriction, b.fFriction)) * fClosing / (fInvMassA + fInvMassB);
+		*a.vx -= fImpulse * fInvMassA * nx;
+		*a.vy -= fImpulse * fInvMassA * ny;
+		*b.vx += fImpulse * fInvMassB * nx;
+		*b.vy += fImpulse * fInvMassB * ny;
+		WakeBody(a);
+		WakeBody(b);
+
+		if (a.pObject != nullptr && b.pObject != nullptr) {
+			Bounced(a.pObject, a.ref, commands);
+			Bounced(b.pObject, b.ref, commands);
+		}
+	}
+
+	// Carry out the recorded commands, a kind at a time: new missiles, explosions, the damage
+	// they do, then the dead leave their pools and any handle to one resolves to nullptr
+	void ExecuteCommands() {
+		for (auto& s : commands.vecSpawn) {
+			SlotHandle h = missiles.Emplace(s.x, s.y, s.vx, s.vy);
+			nAwakeObjects++;
+			if (s.bTrack)
+				TrackMissile(h);
+		}
+
+		// The camera stops where a missile it was following went off
+		if (!commands.vecExplode.empty())
+			TrackWorm(SlotHandle());
+		ApplyBlasts();
+
+		for (auto& d : commands.vecDamage)
+			if (cPhysicsObject* p = Resolve(d.obj))
+				p->Damage(d.fAmount);
+
+		for (auto& k : commands.vecKill) {
+			cPhysicsObject* p = Resolve(k);
+			if (p != nullptr && !p->bDead) {
+				p->bDead = true;
+				if (!p->bAsleep)
+					nAwakeObjects--;
+			}
+		}
+		worms.RemoveIf([](cWorm& o) { return o.bDead; });
+		missiles.RemoveIf([](cMissile& o) { return o.bDead; });
+
+		m_profiler.Count(nCounterSamples, commands.nSamples);
+		commands.Clear();
+	}
+
+	// Half width of each row of a crater of radius r, from the centre row outwards. Traced
+	// once per radius with the midpoint circle, so the crater shape is unchanged
+	const vector<int>& CraterSpans(int r) {
+		if (r >= (int)vecCraterSpans.size())
+			vecCraterSpans.resize(r + 1);
+
+		vector<int>& spans = vecCraterSpans[r];
+		if (spans.empty()) {
+			spans.assign(r + 1, 0);
 			int x = 0;
 			int y = r;
 			int p = 3 - 2 * r;
-			if (!r) 
-				return;
-
-			auto drawline = [&](int sx, int ex, int ny) {
-				for (int i = sx; i < ex; i++)
-					if (ny >= 0 && ny < nMapHeight && i >= 0 && i < nMapWidth)
-						map[ny * nMapWidth + i] = 0;
-			};
-
 			while (y >= x) { // only formulate 1/8 of circle
-				//Filled Circle
-				drawline(xc - x, xc + x, yc - y);
-				drawline(xc - y, xc + y, yc - x);
-				drawline(xc - x, xc + x, yc + y);
-				drawline(xc - y, xc + y, yc + x);
+				spans[y] = max(spans[y], x);
+				spans[x] = max(spans[x], y);
 				if (p < 0)
 					p += 4 * x++ + 6;
 				else
 					p += 4 * (x++ - y--) + 10;
 			}
+		}
+		return spans;
+	}
+
+	// The explosions from the command buffer, all at once. Damage is recorded to follow them
+	void ApplyBlasts() {
+		const vector<sBlast>& vecBlasts = commands.vecExplode;
+		if (vecBlasts.empty())
+			return;
+
+		ProfileScope scope(m_profiler, nPhaseBoom);
+		nBlastsApplied += (int)vecBlasts.size();
+
+		// Erase Terrain to form craters, a clipped span per row, then bring the field,
+		// pyramid and baked cells up to date inside them
+		for (auto& b : vecBlasts) {
+			int xc = (int)b.x, yc = (int)b.y, r = (int)b.radius;
+			if (r <= 0)
+				continue;
+
+			const vector<int>& spans = CraterSpans(r);
+			for (int dy = max(-r, -yc); dy <= min(r, nMapHeight - 1 - yc); dy++)
+				terrain.ClearSpan(xc - spans[abs(dy)], xc + spans[abs(dy)], yc + dy);
+		}
+		terrain.Update();
+		for (auto& b : vecBlasts) {
+			int xc = (int)b.x, yc = (int)b.y, r = (int)b.radius;
+			terrainLayer.Update(xc - r, yc - r, xc + r, yc + r + 1);
+		}
+
+		// Shockwave everything in range, found through the spatial hash. Objects take damage.
+		// Anything just outside may have lost the ground it was resting on, so it wakes too
+		IndexBodies();
+		for (auto& b : vecBlasts)
+			bodyHash.Query(b.x, b.y, b.radius + fMaxBodyRadius + 1.0f, [&](int i) {
+				const sBody& body = vecBodies[i];
+				float dx = *body.px - b.x;
+				float dy = *body.py - b.y;
+				float fDist = sqrtf(dx * dx + dy * dy);
+
+				// Security check
+				if (fDist < 0.0001f)
+					fDist = 0.0001f;
+
+				if (fDist < b.radius) {
+					*body.vx = (dx / fDist) * b.radius;
+					*body.vy = (dy / fDist) * b.radius;
+					if (body.pObject != nullptr) {
+						commands.vecDamage.push_back({ body.ref, ((b.radius - fDist) / b.radius) * 0.8f }); // Corrected ;)
+						body.pObject->bStable = false;
+						WakeObject(body.pObject);
+					}
+					else
+						debris.Wake(body.nDebris);
+				}
+				else if (fDist < b.radius + body.r + 1.0f) {
+					if (body.pObject != nullptr)
+						WakeObject(body.pObject);
+					else
+						debris.Wake(body.nDebris);
+				}
+			});
+
+		// Launch debris
+		for (auto& b : vecBlasts)
+			debris.Spawn(b.x, b.y, (int)b.radius);
+	}
+
+	// Shot Planner
+	// The AI tries shots out rather than solving for them. Angles and energies are drawn at
+	// random, and each is flown a few times with a little jitter through the same physics
+	// step the game uses, against the terrain as it is and the worms where they stand. A
+	// shot scores the damage its blast does to other teams, less half again what it does to
+	// the shooter's own, averaged over its flights, so a shot that only works if everything
+	// goes exactly right doesn't win. Flights run in parallel on the worker pool. They only
+	// read the terrain and nothing changes it while they do, so it serves as its own snapshot.
+	// The work is fixed by the number of shots, flights and flight time, so the same shot is
+	// picked on any machine. fPlanBudget only cuts a plan short on one far too slow to finish
+	// it, and then which shots were tried, and so the pick, depends on timing
+	sShot PlanShot(cWorm* shooter) {
+		ProfileScope scope(m_profiler, nPhasePlan);
+
+		vecPlanTargets.clear();
+		for (auto& w : worms)
+			if (w.fHealth > 0.0f)
+				vecPlanTargets.push_back({ w.px, w.py, w.radius, w.fHealth, w.nTeam != shooter->nTeam, &w == shooter });
+
+		// Seeded from the game's own random numbers, one draw per plan
+		uint32_t nRandom = (uint32_t)rand() * 2654435761u | 1u;
+		auto Random = [&]() {
+			nRandom ^= nRandom << 13;
+			nRandom ^= nRandom >> 17;
+			nRandom ^= nRandom << 5;
+			return (nRandom & 0xFFFFFF) / (float)0x1000000;
 		};
+		vecPlanShots.resize(nPlanCandidates);
+		for (auto& s : vecPlanShots) {
+			s.fAngle = -3.04159f + 2.94159f * Random();	// Anywhere from nearly flat left to nearly flat right
+			s.fEnergy = 0.25f + 0.75f * Random();
+			s.fScore = -1e30f;
+		}
 
-		// Erase Terrain to form crater
-		CircleBresenham(fWorldX, fWorldY, fRadius);
+		float x = shooter->px, y = shooter->py;
+		auto tpDeadline = chrono::steady_clock::now() + chrono::duration<float>(fPlanBudget);
+		ParallelRanges(RangeCount(nPlanCandidates, 4), nPlanCandidates, [&](int nRange, int i1, int i2) {
+			for (int i = i1; i < i2 && chrono::steady_clock::now() < tpDeadline; i++) {
+				sShot& s = vecPlanShots[i];
+				float fTotal = 0.0f;
+				for (int k = 0; k < nPlanSamples; k++) {
+					// Spread evenly either side of the shot, as aim and charge may be off a little
+					float fJitter = (k + 0.5f) / nPlanSamples - 0.5f;
+					fTotal += SimulateShot(x, y, s.fAngle + 0.04f * fJitter, s.fEnergy - 0.04f * fJitter);
+				}
+				s.fScore = fTotal / nPlanSamples;
+			}
+		});
+
+		// If no shot was tried in time, fire straight at the target
+		sShot best = { atan2f(fAITargetY - y, fAITargetX - x), 0.75f, -1e30f };
+		for (auto& s : vecPlanShots)
+			if (s.fScore > best.fScore)
+				best = s;
+		return best;
+	}
 
-		// Shockwave other entities in range
-		for (auto& p : listObjects) {
-			float dx = p->px - fWorldX;
-			float dy = p->py - fWorldY;
-			float fDist = sqrt(dx * dx + dy * dy);
-
-			// Security check
-			if (fDist < 0.0001f)
-				fDist = 0.0001f;
-
-			if (fDist < fRadius) {
-				p->vx = (dx / fDist) * fRadius;
-				p->vy = (dy / fDist) * fRadius;
-				p->Damage(((fRadius - fDist) / fRadius) * 0.8f); // Corrected ;)
-				p->bStable = false;
+	// Fly one missile from x, y and score where it goes off, 0 if it never does
+	float SimulateShot(float x, float y, float fAngle, float fEnergy) {
+		cMissile m(x, y, cosf(fAngle) * 40.0f * fEnergy, sinf(fAngle) * 40.0f * fEnergy);
+		sCommandBuffer cmd;
+		const float fStep = fPhysicsTimeScale / (float)nPhysicsTickRate;
+
+		// The missile starts inside its own worm, it can only hit it once it has got clear
+		bool bClear = false;
+		for (float t = 0.0f; t < fPlanFlightTime; t += fStep) {
+			StepObjectAdaptive(&m, sObjectRef{}, fStep, cmd);
+			if (!cmd.vecExplode.empty())
+				return ScoreBlast(cmd.vecExplode[0].x, cmd.vecExplode[0].y, cmd.vecExplode[0].radius);
+			if (!cmd.vecKill.empty())
+				return 0.0f;
+
+			for (auto& w : vecPlanTargets) {
+				float dx = m.px - w.x;
+				float dy = m.py - w.y;
+				bool bTouching = dx * dx + dy * dy < (m.radius + w.radius) * (m.radius + w.radius);
+				if (w.bShooter && !bClear) {
+					bClear = !bTouching;
+					continue;
+				}
+				if (bTouching)
+					return ScoreBlast(m.px, m.py, (float)m.BounceDeathAction());
 			}
 		}
+		return 0.0f;
+	}
 
-		// Launch debris
-		for (int i = 0; i < (int)fRadius; i++)
-			listObjects.push_back(unique_ptr<cDebris>(new cDebris(fWorldX, fWorldY)));
+	// Damage a blast would do to the other teams, less half again the damage to our own
+	float ScoreBlast(float x, float y, float fRadius) {
+		float fScore = 0.0f;
+		for (auto& w : vecPlanTargets) {
+			float dx = w.x - x;
+			float dy = w.y - y;
+			float fDist = sqrtf(dx * dx + dy * dy);
+			if (fDist >= fRadius)
+				continue;
+
+			float fDamage = min(w.fHealth, ((fRadius - fDist) / fRadius) * 0.8f);
+			fScore += w.bEnemy ? fDamage : -1.5f * fDamage;
+		}
+		return fScore;
 	}
 
 	// 1D Perlin Noise
@@ -1150,20 +2697,13 @@ private:
 		fNoiseSeed[0] = 0.5f; // first and last element starts half way up to provide more place for players to fight
 		PerlinNoise1D(nMapWidth, fNoiseSeed, 8, 2.0f, fSurface);
 
-		// Any value that is within the perlin height is set to 1 to represent terrain, all else is 0 for empty space
+		// Any pixel that is within the perlin height is set to represent terrain, all else is empty space
+		vector<int> vecTop(nMapWidth);
 		for (int x = 0; x < nMapWidth; x++)
-			for (int y = 0; y < nMapHeight; y++) {
-				if (y >= fSurface[x] * nMapHeight)
-					map[y * nMapWidth + x] = 1;
-				else {
-					// Shade the sky according to altitude - we only do top 1/3 of map
-					// as the Boom() function will just paint in 0 (cyan)
-					if ((float)y < (float)nMapHeight / 3.0f)
-						map[y * nMapWidth + x] = (-8.0f * ((float)y / (nMapHeight / 3.0f))) - 1.0f;
-					else
-						map[y * nMapWidth + x] = 0;
-				}
-			}
+			vecTop[x] = (int)ceilf(fSurface[x] * nMapHeight);
+		terrain.Create(nMapWidth, nMapHeight);
+		terrain.SetColumns(vecTop);
+		BakeTerrain();
 
 		// Clean up allocated space
 		delete[] fSurface;
@@ -1171,10 +2711,52 @@ private:
 	}
 };
 
-int main() {
+int main(int argc, char* argv[]) {
 	WormGun game;
+
+	// "-headless [frames]" runs the whole game with no terminal, as fast as it will go,
+	// stepping a steady 60Hz of game time per frame. "-map width height" sizes the terrain,
+	// "-tick rate" sets how many physics ticks run per second
+	auto IsNumber = [](const char* s) {
+		char* pEnd;
+		strtol(s, &pEnd, 10);
+		return pEnd != s && *pEnd == '\0';
+	};
+
+	bool bHeadless = false;
+	int nFrames = 3600;
+	for (int a = 1; a < argc; a++) {
+		if (string(argv[a]) == "-headless") {
+			bHeadless = true;
+			if (a + 1 < argc && IsNumber(argv[a + 1]))
+				nFrames = atoi(argv[a + 1]);
+		}
+		if (string(argv[a]) == "-map" && a + 2 < argc)
+			game.SetMapSize(max(256, atoi(argv[a + 1])), max(160, atoi(argv[a + 2])));
+		if (string(argv[a]) == "-tick" && a + 1 < argc)
+			game.SetPhysicsTickRate(atoi(argv[a + 1]));
+	}
+
+	HeadlessConsoleBackend* pHeadless = nullptr;	// Owned by the game
+	if (bHeadless) {
+		pHeadless = new HeadlessConsoleBackend(nFrames);
+		game.SetBackend(pHeadless);
+		game.SetFixedElapsedTime(1.0f / 60.0f);
+		game.SetTargetFrameRate(0.0f);
+		game.SetIdleFrameRate(0.0f);
+	}
+
 	game.ConstructConsole(256, 160, 6, 6);
+
+	auto tpStart = chrono::steady_clock::now();
 	game.Start();
+	chrono::duration<float> fRunTime = chrono::steady_clock::now() - tpStart;
+
+	// The game may have quit before running all it was asked to
+	if (pHeadless != nullptr) {
+		int nRan = pHeadless->FrameCount();
+		printf("%d frames in %.3fs, %.3fms per frame\n", nRan, fRunTime.count(), 1000.0f * fRunTime.count() / max(1, nRan));
+	}
 
 	return 0;
 }
\ No newline at end of file